@@ -0,0 +1,57 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <functional>
+#include <chrono>
+#include <cstdint>
+
+// Minimal benchmark harness for `make bench`. A benchmark body runs
+// `st.iterations` operations; the runner calibrates the count to a minimum
+// wall time, repeats the measurement and keeps the median. Bodies that care
+// about tail latency can push per-operation samples with st.sample().
+struct BenchState {
+    uint64_t iterations{1};
+    uint64_t items_per_iter{1};         // e.g. 1M for a bench that processes a whole history per op
+    std::vector<uint64_t> samples;      // optional per-op latencies in ns
+
+    void pause(){ paused_at = clock::now(); }
+    void resume(){ excluded += clock::now() - paused_at; }
+    void sample(uint64_t ns){ samples.push_back(ns); }
+
+    using clock = std::chrono::steady_clock;
+    clock::time_point paused_at;
+    clock::duration excluded{0};
+};
+
+struct BenchResult {
+    std::string name;
+    uint64_t iterations{0};
+    double ns_per_op{0};
+    double ops_per_sec{0};
+    double p50_ns{0};
+    double p99_ns{0};
+};
+
+using BenchFn = std::function<void(BenchState&)>;
+
+struct BenchCase {
+    std::string name;
+    BenchFn fn;
+    bool fixed{false};      // run exactly once per repetition (expensive setup-heavy benches)
+};
+
+std::vector<BenchCase>& bench_registry();
+
+struct BenchRegistrar {
+    BenchRegistrar(const std::string& name, BenchFn fn, bool fixed = false){
+        bench_registry().push_back({name, std::move(fn), fixed});
+    }
+};
+
+#define BENCH_CAT2(a, b) a##b
+#define BENCH_CAT(a, b) BENCH_CAT2(a, b)
+#define BENCHMARK(name, ...) static BenchRegistrar BENCH_CAT(bench_reg_, __LINE__)(name, __VA_ARGS__)
+
+// Keeps the optimizer from discarding a computed value.
+template <class T>
+inline void do_not_optimize(const T& v){ asm volatile("" : : "r,m"(v) : "memory"); }
@@ -0,0 +1,168 @@
+#include "bench.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+
+std::vector<BenchCase>& bench_registry(){
+    static std::vector<BenchCase> r;
+    return r;
+}
+
+struct Options {
+    std::string filter;
+    std::string json_out;
+    std::string compare;
+    double min_time_ms{200};
+    int repetitions{5};
+    double threshold_pct{10};
+};
+
+static double run_once(const BenchCase& bc, uint64_t iters, BenchState& st){
+    st = BenchState{};
+    st.iterations = iters;
+    auto t0 = BenchState::clock::now();
+    bc.fn(st);
+    auto dt = BenchState::clock::now() - t0 - st.excluded;
+    return std::chrono::duration<double, std::nano>(dt).count();
+}
+
+static double percentile(std::vector<uint64_t>& v, double q){
+    if(v.empty()) return 0;
+    size_t k = std::min(v.size() - 1, (size_t)(q * v.size()));
+    std::nth_element(v.begin(), v.begin() + k, v.end());
+    return (double)v[k];
+}
+
+static BenchResult run_case(const BenchCase& bc, const Options& opt){
+    BenchState st;
+    uint64_t iters = 1;
+    if(!bc.fixed){
+        // grow the iteration count until one run takes at least min_time
+        double min_ns = opt.min_time_ms * 1e6;
+        while(true){
+            double ns = run_once(bc, iters, st);
+            if(ns >= min_ns || iters >= (1ull << 40)) break;
+            double scale = ns > 0 ? min_ns / ns * 1.2 : 10;
+            iters = (uint64_t)std::max<double>(iters * 2, std::min<double>(iters * scale, iters * 100.0));
+        }
+    }
+    std::vector<double> per_op;
+    std::vector<uint64_t> samples;
+    for(int r=0;r<opt.repetitions;++r){
+        double ns = run_once(bc, iters, st);
+        per_op.push_back(ns / (double)(iters * st.items_per_iter));
+        samples.insert(samples.end(), st.samples.begin(), st.samples.end());
+    }
+    std::sort(per_op.begin(), per_op.end());
+    BenchResult res;
+    res.name = bc.name;
+    res.iterations = iters * st.items_per_iter;
+    res.ns_per_op = per_op[per_op.size() / 2];
+    res.ops_per_sec = res.ns_per_op > 0 ? 1e9 / res.ns_per_op : 0;
+    res.p50_ns = percentile(samples, 0.50);
+    res.p99_ns = percentile(samples, 0.99);
+    return res;
+}
+
+static std::string json_escape(const std::string& s){
+    std::string o;
+    for(char c: s){
+        if(c=='"' || c=='\\') o += '\\';
+        o += c;
+    }
+    return o;
+}
+
+static void write_json(const std::string& path, const std::vector<BenchResult>& results){
+    std::ofstream ofs(path);
+    ofs << "{\n  \"benchmarks\": [\n";
+    for(size_t i=0;i<results.size();++i){
+        const auto& r = results[i];
+        char buf[512];
+        snprintf(buf, sizeof(buf),
+                 "    {\"name\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %.3f, \"ops_per_sec\": %.1f, \"p50_ns\": %.1f, \"p99_ns\": %.1f}%s\n",
+                 json_escape(r.name).c_str(), (unsigned long long)r.iterations, r.ns_per_op, r.ops_per_sec,
+                 r.p50_ns, r.p99_ns, i+1<results.size() ? "," : "");
+        ofs << buf;
+    }
+    ofs << "  ]\n}\n";
+}
+
+// Reads back the format written by write_json: name -> ns_per_op.
+static std::map<std::string, double> read_baseline(const std::string& path){
+    std::map<std::string, double> out;
+    std::ifstream ifs(path);
+    std::string line;
+    while(std::getline(ifs, line)){
+        auto n = line.find("\"name\": \"");
+        auto v = line.find("\"ns_per_op\": ");
+        if(n == std::string::npos || v == std::string::npos) continue;
+        n += 9;
+        auto e = line.find('"', n);
+        out[line.substr(n, e - n)] = std::strtod(line.c_str() + v + 13, nullptr);
+    }
+    return out;
+}
+
+static void usage(){
+    std::cerr << "usage: myshell_bench [--filter=substr] [--json=out.json] [--compare=baseline.json]\n"
+                 "                     [--threshold=pct] [--min-time=ms] [--repetitions=n] [--list]\n";
+}
+
+int main(int argc, char** argv){
+    Options opt;
+    bool list = false;
+    for(int i=1;i<argc;++i){
+        std::string a = argv[i];
+        auto val = [&](const char* key) -> const char* {
+            size_t k = strlen(key);
+            return a.compare(0, k, key) == 0 ? a.c_str() + k : nullptr;
+        };
+        if(const char* v = val("--filter=")) opt.filter = v;
+        else if(const char* v = val("--json=")) opt.json_out = v;
+        else if(const char* v = val("--compare=")) opt.compare = v;
+        else if(const char* v = val("--threshold=")) opt.threshold_pct = std::atof(v);
+        else if(const char* v = val("--min-time=")) opt.min_time_ms = std::atof(v);
+        else if(const char* v = val("--repetitions=")) opt.repetitions = std::max(1, std::atoi(v));
+        else if(a == "--list") list = true;
+        else { usage(); return 2; }
+    }
+
+    std::vector<BenchResult> results;
+    printf("%-36s %14s %14s %12s %12s\n", "benchmark", "ns/op", "ops/s", "p50 ns", "p99 ns");
+    for(const auto& bc: bench_registry()){
+        if(!opt.filter.empty() && bc.name.find(opt.filter) == std::string::npos) continue;
+        if(list){ printf("%s\n", bc.name.c_str()); continue; }
+        BenchResult r = run_case(bc, opt);
+        printf("%-36s %14.1f %14.0f %12.0f %12.0f\n", r.name.c_str(), r.ns_per_op, r.ops_per_sec, r.p50_ns, r.p99_ns);
+        fflush(stdout);
+        results.push_back(r);
+    }
+    if(list) return 0;
+    if(!opt.json_out.empty()) write_json(opt.json_out, results);
+
+    if(opt.compare.empty()) return 0;
+    auto base = read_baseline(opt.compare);
+    if(base.empty()){
+        std::cerr << "myshell_bench: no results in baseline " << opt.compare << "\n";
+        return 2;
+    }
+    int regressions = 0;
+    printf("\n%-36s %14s %14s %9s\n", "compared to baseline", "base ns/op", "ns/op", "delta");
+    for(const auto& r: results){
+        auto it = base.find(r.name);
+        if(it == base.end() || it->second <= 0){
+            printf("%-36s %14s %14.1f %9s\n", r.name.c_str(), "-", r.ns_per_op, "new");
+            continue;
+        }
+        double delta = (r.ns_per_op - it->second) / it->second * 100.0;
+        bool bad = delta > opt.threshold_pct;
+        regressions += bad;
+        printf("%-36s %14.1f %14.1f %+8.1f%%%s\n", r.name.c_str(), it->second, r.ns_per_op, delta, bad ? "  REGRESSION" : "");
+    }
+    return regressions ? 1 : 0;
+}
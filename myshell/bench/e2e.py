@@ -0,0 +1,307 @@
+#!/usr/bin/env python3
+"""End-to-end shell benchmark: myshell vs bash vs dash as script runners.
+
+Every workload is generated into a scratch directory, so runs are repeatable
+on an isolated box (no network, no user rc files: HOME points at the scratch
+directory and PATH is fixed). For each shell and workload it reports
+
+  cmds/s     commands per second over the whole script (median of --reps runs)
+  p50/p99    per-command latency, measured in lockstep over a pipe (or pty):
+             one command is written, then a `pwd` marker, and the clock stops
+             when the marker's output comes back
+  peak RSS   the shell process's own VmHWM, sampled from /proc while it runs
+             (ru_maxrss is useless here: it carries over the driver's
+             high-water mark across fork+exec)
+
+Usage: bench/e2e.py [--shells=myshell,bash,dash] [--workloads=...] [--reps=3]
+                    [--scale=1.0] [--samples=300] [--json=out.json]
+"""
+import argparse
+import json
+import os
+import pty
+import re
+import select
+import shutil
+import statistics
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+MYSHELL = os.path.join(os.path.dirname(HERE), "myshell")
+
+SHELLS = {
+    "myshell": {"script": [MYSHELL], "stdin": [MYSHELL], "interactive": [MYSHELL]},
+    "bash": {"script": ["bash", "--norc", "--noprofile"], "stdin": ["bash", "--norc", "--noprofile", "-s"],
+             "interactive": ["bash", "--norc", "--noprofile", "-i"]},
+    "dash": {"script": ["dash"], "stdin": ["dash", "-s"], "interactive": ["dash", "-i"]},
+}
+
+
+# ---- workloads: each returns the list of command lines ----
+
+def wl_trivial(scale, work):
+    return ["/bin/true"] * int(10000 * scale)
+
+
+def wl_pipelines(scale, work):
+    data = os.path.join(work, "data.txt")
+    with open(data, "w") as f:
+        for i in range(2000):
+            f.write("line %d of some input text\n" % i)
+    stage = " | /bin/cat" * 15
+    return ["/bin/cat %s%s > /dev/null" % (data, stage)] * int(300 * scale)
+
+
+def wl_bg_fanout(scale, work):
+    return ["/bin/true &"] * int(2000 * scale)
+
+
+def wl_redirection(scale, work):
+    a, b = os.path.join(work, "a.txt"), os.path.join(work, "b.txt")
+    lines = []
+    for i in range(int(1500 * scale)):
+        lines.append("/bin/echo line %d > %s" % (i, a))
+        lines.append("/bin/cat < %s >> %s" % (a, b))
+    return lines
+
+
+SCRIPT_WORKLOADS = {
+    "trivial": wl_trivial,
+    "pipelines": wl_pipelines,
+    "bg_fanout": wl_bg_fanout,
+    "redirection": wl_redirection,
+}
+
+
+def env_for(work):
+    return {"HOME": work, "PATH": "/usr/bin:/bin", "LC_ALL": "C", "PS1": "$ ", "TERM": "dumb",
+            "MYSHELL_METRICS": "0"}
+
+
+def percentile(xs, q):
+    if not xs:
+        return 0.0
+    xs = sorted(xs)
+    return xs[min(len(xs) - 1, int(q * len(xs)))]
+
+
+def vm_hwm(pid):
+    """Peak resident set of a live process in KiB, 0 once it is gone."""
+    try:
+        with open("/proc/%d/status" % pid) as f:
+            for line in f:
+                if line.startswith("VmHWM:"):
+                    return int(line.split()[1])
+    except OSError:
+        pass
+    return 0
+
+
+class HwmSampler(threading.Thread):
+    """Polls VmHWM of `pid` until stopped; VmHWM only grows, so the last
+    successful read before exit is the peak."""
+
+    def __init__(self, pid, interval=0.01):
+        super().__init__(daemon=True)
+        self.pid, self.interval, self.peak = pid, interval, 0
+        self.done = threading.Event()
+        self.start()
+
+    def run(self):
+        while not self.done.is_set():
+            self.peak = max(self.peak, vm_hwm(self.pid))
+            self.done.wait(self.interval)
+
+    def stop(self):
+        self.done.set()
+        self.join()
+        return self.peak
+
+
+# ---- throughput: run the whole script file ----
+
+def run_script(shell, lines, work):
+    path = os.path.join(work, "script.sh")
+    with open(path, "w") as f:
+        f.write("\n".join(lines) + "\n")
+    argv = SHELLS[shell]["script"] + [path]
+    t0 = time.perf_counter()
+    p = subprocess.Popen(argv, cwd=work, env=env_for(work), stdin=subprocess.DEVNULL,
+                         stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    hwm = HwmSampler(p.pid)
+    p.wait()
+    wall = time.perf_counter() - t0
+    return wall, hwm.stop()
+
+
+# ---- latency: lockstep over a pipe ----
+
+def sample_latency(shell, lines, work, samples):
+    p = subprocess.Popen(SHELLS[shell]["stdin"], cwd=work, env=env_for(work), stdin=subprocess.PIPE,
+                         stdout=subprocess.PIPE, stderr=subprocess.DEVNULL, bufsize=0)
+    fd = p.stdout.fileno()
+    marker = work.encode()
+    buf = b""
+    lat = []
+    step = max(1, len(lines) // samples)
+    for line in lines[::step][:samples]:
+        t0 = time.perf_counter()
+        p.stdin.write(line.encode() + b"\npwd\n")
+        while True:
+            nl = buf.find(b"\n")
+            if nl >= 0:
+                got, buf = buf[:nl], buf[nl + 1:]
+                if got.endswith(marker):
+                    break
+                continue
+            chunk = os.read(fd, 65536)
+            if not chunk:
+                raise RuntimeError("%s exited during latency sampling" % shell)
+            buf += chunk
+        lat.append(time.perf_counter() - t0)
+    p.stdin.close()
+    p.wait()
+    return lat
+
+
+# ---- interactive pty session with job control ----
+
+class PtySession:
+    PROMPT = re.compile(rb"\$ $")
+
+    def __init__(self, shell, work):
+        env = env_for(work)
+        self.pid, self.fd = pty.fork()
+        if self.pid == 0:
+            os.chdir(work)
+            argv = SHELLS[shell]["interactive"]
+            os.execvpe(argv[0], argv, env)
+        self.buf = b""
+        self.wait_prompt()
+
+    def read_until(self, pred, timeout=10.0):
+        end = time.perf_counter() + timeout
+        while not pred(self.buf):
+            left = end - time.perf_counter()
+            if left <= 0:
+                raise RuntimeError("timeout waiting for shell output: %r" % self.buf[-200:])
+            r, _, _ = select.select([self.fd], [], [], left)
+            if r:
+                self.buf += os.read(self.fd, 65536)
+
+    def wait_prompt(self):
+        self.read_until(lambda b: self.PROMPT.search(b) is not None)
+        out, self.buf = self.buf, b""
+        return out
+
+    def command(self, line):
+        t0 = time.perf_counter()
+        os.write(self.fd, line.encode() + b"\n")
+        out = self.wait_prompt()
+        return time.perf_counter() - t0, out
+
+    def close(self):
+        rss = vm_hwm(self.pid)
+        os.write(self.fd, b"exit\n")
+        try:
+            while os.read(self.fd, 65536):
+                pass
+        except OSError:
+            pass
+        os.waitpid(self.pid, 0)
+        os.close(self.fd)
+        return rss
+
+
+def job_spec(out):
+    """Jobspec of the last job mentioned in `out`; dash does not announce
+    background jobs, so fall back to the current job."""
+    ids = re.findall(rb"\[(\d+)\]", out)
+    return "%%%d" % int(ids[-1]) if ids else "%%"
+
+
+def run_pty(shell, scale, work):
+    """Rounds of: background a job and fg it; run a job, stop it with ^Z, bg it, fg it."""
+    rounds = max(1, int(40 * scale))
+    s = PtySession(shell, work)
+    lat = []
+    t0 = time.perf_counter()
+    for _ in range(rounds):
+        dt, out = s.command("/bin/sleep 0.01 &")
+        lat.append(dt)
+        dt, _ = s.command("fg " + job_spec(out))
+        lat.append(dt)
+
+        os.write(s.fd, b"/bin/sleep 0.15\n")
+        time.sleep(0.02)
+        os.write(s.fd, b"\x1a")
+        s.wait_prompt()
+        dt, out = s.command("jobs")
+        lat.append(dt)
+        spec = job_spec(out)
+        dt, _ = s.command("bg " + spec)
+        lat.append(dt)
+        dt, _ = s.command("fg " + spec)
+        lat.append(dt)
+    wall = time.perf_counter() - t0
+    rss = s.close()
+    return len(lat) + rounds, wall, lat, rss
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("--shells", default="myshell,bash,dash")
+    ap.add_argument("--workloads", default=",".join(list(SCRIPT_WORKLOADS) + ["pty_jobs"]))
+    ap.add_argument("--reps", type=int, default=3)
+    ap.add_argument("--scale", type=float, default=1.0, help="multiply workload sizes")
+    ap.add_argument("--samples", type=int, default=300, help="latency samples per workload")
+    ap.add_argument("--json", help="write results as JSON")
+    args = ap.parse_args()
+
+    shells = [s for s in args.shells.split(",") if s]
+    for s in shells:
+        exe = SHELLS[s]["script"][0]
+        if not (os.access(exe, os.X_OK) or shutil.which(exe)):
+            sys.exit("e2e: %s not found (%s)" % (s, exe))
+
+    results = []
+    print("%-12s %-8s %10s %12s %10s %10s %10s" % ("workload", "shell", "commands", "cmds/s", "p50 us", "p99 us", "rss KiB"))
+    for wl in [w for w in args.workloads.split(",") if w]:
+        for shell in shells:
+            work = tempfile.mkdtemp(prefix="myshell-e2e-")
+            try:
+                if wl == "pty_jobs":
+                    n, wall, lat, rss = run_pty(shell, args.scale, work)
+                    walls = [wall]
+                else:
+                    lines = SCRIPT_WORKLOADS[wl](args.scale, work)
+                    n = len(lines)
+                    run_script(shell, lines, work)          # warm-up
+                    runs = [run_script(shell, lines, work) for _ in range(args.reps)]
+                    walls = [w for w, _ in runs]
+                    rss = max(r for _, r in runs)
+                    lat = sample_latency(shell, lines, work, args.samples)
+            finally:
+                shutil.rmtree(work, ignore_errors=True)
+            r = {
+                "workload": wl, "shell": shell, "commands": n,
+                "cmds_per_sec": n / statistics.median(walls),
+                "p50_us": percentile(lat, 0.50) * 1e6,
+                "p99_us": percentile(lat, 0.99) * 1e6,
+                "peak_rss_kib": rss,
+            }
+            results.append(r)
+            print("%-12s %-8s %10d %12.0f %10.0f %10.0f %10d" % (wl, shell, n, r["cmds_per_sec"], r["p50_us"],
+                                                              r["p99_us"], rss))
+            sys.stdout.flush()
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump({"results": results}, f, indent=2)
+
+
+if __name__ == "__main__":
+    main()
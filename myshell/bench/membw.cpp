@@ -0,0 +1,37 @@
+// Memory-bound worker for bench/placement.py: a STREAM-style triad over
+// three arrays of --mb megabytes in total. Prints one result line so the
+// driver can collect it from a background job:
+//
+//   membw pid=1234 cpu=5 mb=256 passes=20 secs=1.234 MBps=12345.6
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <sched.h>
+#include <unistd.h>
+
+int main(int argc, char** argv){
+    size_t mb = 256;
+    int passes = 20;
+    for(int i=1;i<argc;++i){
+        if(strncmp(argv[i], "--mb=", 5) == 0) mb = std::strtoul(argv[i] + 5, nullptr, 10);
+        else if(strncmp(argv[i], "--passes=", 9) == 0) passes = std::atoi(argv[i] + 9);
+        else { fprintf(stderr, "usage: membw [--mb=N] [--passes=N]\n"); return 2; }
+    }
+    size_t n = std::max<size_t>(1, mb * 1024 * 1024 / (3 * sizeof(double)));
+    // first touch happens here, after the shell applied affinity/mempolicy
+    std::vector<double> a(n, 0.0), b(n, 1.0), c(n, 2.0);
+    const double s = 3.0;
+
+    auto t0 = std::chrono::steady_clock::now();
+    for(int p=0;p<passes;++p){
+        for(size_t i=0;i<n;++i) a[i] = b[i] + s * c[i];
+        asm volatile("" : : "r"(a.data()) : "memory");
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    double bytes = 3.0 * sizeof(double) * n * passes;
+    printf("membw pid=%d cpu=%d mb=%zu passes=%d secs=%.3f MBps=%.1f\n",
+           (int)getpid(), sched_getcpu(), mb, passes, secs, bytes / secs / 1e6);
+    return a[n / 2] == 7.0 ? 0 : 1;
+}
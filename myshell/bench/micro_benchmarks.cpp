@@ -0,0 +1,218 @@
+#include "bench.hpp"
+#include "parser.hpp"
+#include "util.hpp"
+#include "builtins.hpp"
+#include "history.hpp"
+#include "logger.hpp"
+#include "thread_pool.hpp"
+#include "completion.hpp"
+#include "deadlines.hpp"
+#include "metrics.hpp"
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Scratch directory used as $HOME / cwd so history and log benches never
+// touch the user's real files.
+static char g_scratch[] = "/tmp/myshell-bench-XXXXXX";
+
+static const std::string& scratch_dir(){
+    static const std::string dir = []{
+        if(!mkdtemp(g_scratch)) { perror("mkdtemp"); exit(1); }
+        setenv("HOME", g_scratch, 1);
+        std::atexit([]{
+            std::error_code ec;
+            std::filesystem::remove_all(g_scratch, ec);
+        });
+        return std::string(g_scratch);
+    }();
+    return dir;
+}
+
+static uint64_t now_ns(){
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// ---- parser ----
+
+BENCHMARK("parser/simple", [](BenchState& st){
+    Parser p;
+    const std::string line = "ls -la /tmp";
+    for(uint64_t i=0;i<st.iterations;++i) do_not_optimize(p.parse(line));
+});
+
+BENCHMARK("parser/pipeline_redirect", [](BenchState& st){
+    Parser p;
+    const std::string line = "cat < in.txt | grep \"foo bar\" | sort -u | uniq -c >> 'out file.txt' &";
+    for(uint64_t i=0;i<st.iterations;++i) do_not_optimize(p.parse(line));
+});
+
+BENCHMARK("parser/long_argv", [](BenchState& st){
+    Parser p;
+    std::string line = "echo";
+    for(int i=0;i<200;++i) line += " arg" + std::to_string(i);
+    for(uint64_t i=0;i<st.iterations;++i) do_not_optimize(p.parse(line));
+});
+
+BENCHMARK("parser/substitution", [](BenchState& st){
+    Parser p;
+    const std::string line = "cp $(find src -name '*.cpp' | head -1) \"$(pwd)/out\" `date +%s`.bak";
+    for(uint64_t i=0;i<st.iterations;++i) do_not_optimize(p.parse(line));
+});
+
+// ---- util ----
+
+BENCHMARK("util/trim", [](BenchState& st){
+    const std::string s = "   \t  some command line with args  \t\n";
+    for(uint64_t i=0;i<st.iterations;++i) do_not_optimize(trim(s));
+});
+
+BENCHMARK("util/split_ws", [](BenchState& st){
+    const std::string s = "git commit -m message --amend --no-edit  -q  ";
+    for(uint64_t i=0;i<st.iterations;++i) do_not_optimize(split_ws(s));
+});
+
+BENCHMARK("util/join", [](BenchState& st){
+    const std::vector<std::string> v = {"cat", "file.txt", "|", "grep", "x", "|", "sort", "-u"};
+    for(uint64_t i=0;i<st.iterations;++i) do_not_optimize(join(v, " "));
+});
+
+// ---- builtin dispatch ----
+
+BENCHMARK("builtins/lookup_hit", [](BenchState& st){
+    const std::vector<std::string> names = {"cd", "jobs", "history", "fg"};
+    for(uint64_t i=0;i<st.iterations;++i) do_not_optimize(builtin_lookup(names[i & 3]));
+});
+
+BENCHMARK("builtins/lookup_miss", [](BenchState& st){
+    const std::vector<std::string> names = {"ls", "grep", "make", "sort"};
+    for(uint64_t i=0;i<st.iterations;++i) do_not_optimize(builtin_lookup(names[i & 3]));
+});
+
+// ---- history (1M entries) ----
+
+static constexpr uint64_t HISTORY_N = 1000000;
+
+BENCHMARK("history/add_1M", [](BenchState& st){
+    scratch_dir();
+    st.items_per_iter = HISTORY_N;
+    for(uint64_t it=0;it<st.iterations;++it){
+        History h;
+        for(uint64_t i=0;i<HISTORY_N;++i) h.add("make -j8 target_" + std::to_string(i & 1023));
+        do_not_optimize(h.data().size());
+    }
+}, true);
+
+BENCHMARK("history/save_1M", [](BenchState& st){
+    std::string path = scratch_dir() + "/.myshell_history";
+    st.items_per_iter = HISTORY_N;
+    for(uint64_t it=0;it<st.iterations;++it){
+        st.pause();
+        unlink(path.c_str());
+        History h;
+        for(uint64_t i=0;i<HISTORY_N;++i) h.add("make -j8 target_" + std::to_string(i & 1023));
+        st.resume();
+        h.save();
+    }
+}, true);
+
+BENCHMARK("history/load_1M", [](BenchState& st){
+    std::string path = scratch_dir() + "/.myshell_history";
+    st.items_per_iter = HISTORY_N;
+    st.pause();
+    {
+        std::ofstream ofs(path, std::ios::trunc);
+        for(uint64_t i=0;i<HISTORY_N;++i) ofs << "make -j8 target_" << (i & 1023) << "\n";
+    }
+    st.resume();
+    for(uint64_t it=0;it<st.iterations;++it){
+        History h;
+        h.load();
+        do_not_optimize(h.data().size());
+    }
+}, true);
+
+// ---- logger: 4 producers hammering one queue ----
+
+BENCHMARK("logger/log_4_producers", [](BenchState& st){
+    static Logger logger(scratch_dir() + "/bench.log");
+    const int threads = 4;
+    uint64_t per = std::max<uint64_t>(1, st.iterations / threads);
+    st.items_per_iter = 1;
+    st.iterations = per * threads;
+    std::vector<std::thread> ts;
+    for(int t=0;t<threads;++t){
+        ts.emplace_back([&]{
+            for(uint64_t i=0;i<per;++i) logger.log("some command line that was typed");
+        });
+    }
+    for(auto& t: ts) t.join();
+});
+
+// ---- thread pool ----
+
+// one task in flight at a time: enqueue -> task start is the worker wakeup latency
+BENCHMARK("thread_pool/enqueue_latency", [](BenchState& st){
+    static ThreadPool pool(2);
+    std::atomic<uint64_t> started{0};
+    for(uint64_t i=0;i<st.iterations;++i){
+        uint64_t t0 = now_ns();
+        pool.enqueue([&started]{ started.store(now_ns(), std::memory_order_release); });
+        uint64_t t1;
+        while((t1 = started.exchange(0, std::memory_order_acquire)) == 0) {}
+        st.sample(t1 - t0);
+    }
+});
+
+// enqueue cost alone when producers outrun the workers
+BENCHMARK("thread_pool/enqueue_burst", [](BenchState& st){
+    static ThreadPool pool(2);
+    std::atomic<uint64_t> done{0};
+    for(uint64_t i=0;i<st.iterations;++i){
+        pool.enqueue([&done]{ done.fetch_add(1, std::memory_order_relaxed); });
+    }
+    st.pause();
+    while(done.load(std::memory_order_relaxed) < st.iterations) std::this_thread::yield();
+    st.resume();
+});
+
+// ---- completion over a directory with 2000 entries ----
+
+BENCHMARK("completion/candidates_2k_files", [](BenchState& st){
+    static const std::string dir = []{
+        std::string d = scratch_dir() + "/completion";
+        mkdir(d.c_str(), 0755);
+        for(int i=0;i<2000;++i) std::ofstream(d + "/file_" + std::to_string(i) + ".txt");
+        return d;
+    }();
+    // candidates are taken from the cwd; restore it so relative output paths keep working
+    auto old = std::filesystem::current_path();
+    std::filesystem::current_path(dir);
+    for(uint64_t i=0;i<st.iterations;++i) do_not_optimize(completion_candidates("file_1"));
+    std::filesystem::current_path(old);
+});
+
+// ---- job deadlines ----
+
+// add() with 10k deadlines already pending; the timerfd is only rearmed when
+// the earliest one changes
+BENCHMARK("deadlines/add_10k_pending", [](BenchState& st){
+    static Deadlines dl;
+    static const uint64_t base = metrics::now_ns() + 3600ull * 1000000000ull;
+    static uint64_t seq = 0;
+    static bool filled = [&]{
+        for(int i=0;i<10000;++i) dl.add({base + (uint64_t)i * 1000000, i, ++seq, false});
+        return true;
+    }();
+    (void)filled;
+    for(uint64_t i=0;i<st.iterations;++i){
+        dl.add({base + ((seq * 2654435761u) % 10000000000ull), (int)i, ++seq, false});
+    }
+});
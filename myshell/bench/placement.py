@@ -0,0 +1,103 @@
+#!/usr/bin/env python3
+"""Placement benchmark: parallel memory-bound background jobs under each
+`pin` policy.
+
+For every policy the driver starts one myshell, sets `pin <policy>`, launches
+--jobs copies of bench/membw as background jobs and waits for all of their
+result lines. Two working-set sizes are run by default:
+
+  llc    per-job arrays of --llc-mb, small enough to live in a cache domain
+         if the job has it to itself; jobs packed onto one domain evict
+         each other
+  dram   --dram-mb per job, so every pass streams from memory and the
+         question is which memory controllers the jobs end up on
+
+Reported per policy: makespan (first launch to last result), aggregate MB/s
+(sum over jobs) and the slowest job's MB/s.
+
+Usage: bench/placement.py [--policies=none,spread,compact,node] [--jobs=N]
+                          [--sizes=llc,dram] [--llc-mb=8] [--dram-mb=256]
+                          [--passes=N] [--json=out.json]
+"""
+import argparse
+import json
+import os
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+MYSHELL = os.path.join(os.path.dirname(HERE), "myshell")
+MEMBW = os.path.join(HERE, "membw")
+RESULT = re.compile(rb"membw pid=(\d+) cpu=(-?\d+) .*secs=([\d.]+) MBps=([\d.]+)")
+
+
+def run_policy(policy, jobs, mb, passes, work):
+    env = {"HOME": work, "PATH": "/usr/bin:/bin", "LC_ALL": "C", "MYSHELL_METRICS": "0"}
+    p = subprocess.Popen([MYSHELL], cwd=work, env=env, stdin=subprocess.PIPE, stdout=subprocess.PIPE,
+                         stderr=subprocess.DEVNULL, bufsize=0)
+    script = "pin %s\n" % policy
+    script += "%s --mb=%d --passes=%d &\n" % (MEMBW, mb, passes) * jobs
+    t0 = time.perf_counter()
+    p.stdin.write(script.encode())
+    buf, results = b"", []
+    while len(results) < jobs:
+        chunk = os.read(p.stdout.fileno(), 65536)
+        if not chunk:
+            raise RuntimeError("myshell exited with %d of %d results" % (len(results), jobs))
+        buf += chunk
+        *lines, buf = buf.split(b"\n")
+        for line in lines:
+            m = RESULT.search(line)
+            if m:
+                results.append({"cpu": int(m.group(2)), "secs": float(m.group(3)), "mbps": float(m.group(4))})
+    makespan = time.perf_counter() - t0
+    p.stdin.write(b"exit\n")
+    p.stdin.close()
+    p.wait()
+    return makespan, results
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("--policies", default="none,spread,compact,node")
+    ap.add_argument("--jobs", type=int, default=max(2, (os.cpu_count() or 2) // 4))
+    ap.add_argument("--sizes", default="llc,dram")
+    ap.add_argument("--llc-mb", type=int, default=8)
+    ap.add_argument("--dram-mb", type=int, default=256)
+    ap.add_argument("--passes", type=int, default=0, help="triad passes per job (default: by size)")
+    ap.add_argument("--json", help="write results as JSON")
+    args = ap.parse_args()
+
+    for exe in (MYSHELL, MEMBW):
+        if not os.access(exe, os.X_OK):
+            sys.exit("placement: %s not built (make bench-placement)" % exe)
+
+    out = []
+    print("%-6s %-8s %5s %10s %12s %12s %8s" % ("size", "policy", "jobs", "makespan", "agg MB/s", "min MB/s", "cpus"))
+    for size in [s for s in args.sizes.split(",") if s]:
+        mb = args.llc_mb if size == "llc" else args.dram_mb
+        passes = args.passes or (400 if size == "llc" else 20)
+        for policy in [p for p in args.policies.split(",") if p]:
+            work = tempfile.mkdtemp(prefix="myshell-place-")
+            try:
+                makespan, res = run_policy(policy, args.jobs, mb, passes, work)
+            finally:
+                shutil.rmtree(work, ignore_errors=True)
+            agg = sum(r["mbps"] for r in res)
+            slow = min(r["mbps"] for r in res)
+            cpus = len(set(r["cpu"] for r in res))
+            out.append({"size": size, "policy": policy, "jobs": args.jobs, "mb": mb, "passes": passes,
+                        "makespan_s": makespan, "agg_mbps": agg, "min_mbps": slow, "distinct_cpus": cpus})
+            print("%-6s %-8s %5d %9.2fs %12.0f %12.0f %8d" % (size, policy, args.jobs, makespan, agg, slow, cpus))
+            sys.stdout.flush()
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump({"results": out}, f, indent=2)
+
+
+if __name__ == "__main__":
+    main()
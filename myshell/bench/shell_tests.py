@@ -0,0 +1,249 @@
+#!/usr/bin/env python3
+"""Scripted behaviour tests: each case feeds a script to myshell on stdin
+(stream mode), or passes it arguments such as a script file, in a scratch
+directory and checks stdout and the exit status.
+A case that doesn't finish within its timeout fails, so hangs show up as
+failures rather than a stuck run.
+
+Usage: bench/shell_tests.py [--filter=substr] [--slow] [-v]
+"""
+import argparse
+import json
+import os
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+MYSHELL = os.path.join(os.path.dirname(HERE), "myshell")
+
+
+class Case:
+    def __init__(self, name, script, out=None, match=None, rc=0, timeout=10, setup=None, slow=False, env=None,
+                 args=None, check=None):
+        self.name = name
+        self.script = script
+        self.out = out          # exact stdout
+        self.match = match      # or: regex that must match all of stdout
+        self.rc = rc
+        self.timeout = timeout
+        self.setup = setup      # setup(workdir), run before the shell starts
+        self.slow = slow        # only with --slow
+        self.env = env or {}    # extra environment for the shell
+        self.args = args or []  # myshell arguments (a script file: stdin is then unused)
+        self.check = check      # check(workdir) after the run: a problem, or ""
+
+
+def fifo_writer(name, delay, data=b"fifo data\n", wait_for=None):
+    """Setup: a FIFO `name` whose writer shows up `delay` seconds later. With
+    `wait_for`, it opens as soon as that file exists, or writes a complaint
+    instead of `data` if it doesn't appear within `delay`."""
+    def setup(work):
+        path = os.path.join(work, name)
+        os.mkfifo(path)
+
+        def write():
+            text = data
+            if wait_for:
+                end = time.time() + delay
+                while not os.path.exists(os.path.join(work, wait_for)):
+                    if time.time() > end:
+                        text = b"%s did not appear\n" % wait_for.encode()
+                        break
+                    time.sleep(0.02)
+            else:
+                time.sleep(delay)
+            with open(path, "wb") as f:
+                f.write(text)
+        threading.Thread(target=write, daemon=True).start()
+    return setup
+
+
+def trace_has(*names):
+    """Check: t.json is a Chrome trace with events of each of `names`."""
+    def check(work):
+        try:
+            with open(os.path.join(work, "t.json")) as f:
+                events = json.load(f)["traceEvents"]
+        except (OSError, ValueError, KeyError) as e:
+            return "no trace: %s" % e
+        missing = set(names) - {e.get("name") for e in events}
+        return "trace lacks %s" % ", ".join(sorted(missing)) if missing else ""
+    return check
+
+
+def files(**content):
+    def setup(work):
+        for name, text in content.items():
+            with open(os.path.join(work, name), "w") as f:
+                f.write(text)
+    return setup
+
+
+CASES = [
+    Case("echo", "echo hello world\n", out="hello world\n"),
+    Case("pipeline", "seq 5 | sort -r | head -2\n", out="5\n4\n"),
+    Case("redirect_out_append", "echo one > f\necho two >> f\ncat < f\n", out="one\ntwo\n"),
+    Case("redirect_in", "wc -l < in\n", out="3\n", setup=files(**{"in": "a\nb\nc\n"})),
+    Case("quotes", "echo 'a  b' \"c  d\"\n", out="a  b c  d\n"),
+    Case("comments_blank_lines", "# comment\n\n   \necho x\n", out="x\n"),
+    Case("cd_pwd", "cd /\npwd\n", out="/\n"),
+    Case("status_of_last_command", "true\nfalse\n", out="", rc=1),
+    Case("command_not_found", "no_such_command_xyz\n", out="", rc=127),
+    Case("background_job", "sleep 0.2 &\necho after\n", match=r"\[\d+\] \d+ sleep 0\.2 &\nafter\n"),
+    Case("long_pipeline", "seq 100 " + "| cat " * 15 + "| tail -1\n", out="100\n"),
+    # the first stage exits long before the last one is running
+    Case("early_exit_first_stage", "/bin/true | cat < fifo\necho done\n", out="fifo data\ndone\n",
+         setup=fifo_writer("fifo", 1)),
+    Case("early_exit_first_stage_32s", "/bin/true | cat < fifo\necho done\n", out="fifo data\ndone\n",
+         setup=fifo_writer("fifo", 32), timeout=45, slow=True),
+    # a background stage blocked before exec must not hold up the shell
+    Case("background_fifo_stage", "cat < fifo &\ntouch marker\necho alive\n",
+         match=r"\[\d+\] \d+ cat &\nalive\nfifo data\n", setup=fifo_writer("fifo", 3, wait_for="marker")),
+    # capture: fg replays what was buffered, then passes the rest through
+    # without dropping any of it
+    Case("capture_fg_passthrough", "capture on\nsh -c 'echo a; sleep 0.3; echo b' &\nsleep 0.1\nfg %1\necho end\n",
+         match=r"\[1\] \d+ sh -c echo a; sleep 0\.3; echo b &\na\nb\nend\n"),
+    Case("capture_fg_lossless", "capture on 64\nseq 200000 &\nfg %1\n",
+         match=r"\[1\] \d+ seq 200000 &\n" + re.escape("".join("%d\n" % i for i in range(1, 200001)))),
+    Case("capture_jobs_o", "capture on\nseq 5 &\nsleep 0.3\njobs -o %1 2\n", match=r"\[1\] \d+ seq 5 &\n4\n5\n"),
+    # timeouts: bad durations are refused, finished jobs leave no deadlines
+    # behind, and bg --deadline applies to the job it names
+    Case("timeout_bad_durations", "timeout inf true\ntimeout nan true\ntimeout 1e400 true\ntimeout -1 true\necho next\n",
+         out="next\n"),
+    Case("timeout_huge_duration", "timeout 1e30 echo ok\n", out="ok\n"),
+    Case("timeout_deadlines_pruned", "timeout 1h true\n" * 40 + "sleep 5 &\nbg --deadline=1h %41\nstats\n",
+         match=r".*\ndeadlines pending: 1\n.*"),
+    Case("timeout_deadlines_rearmed", "sleep 5 &\nbg --deadline=2h %1\nbg --deadline=1h %1\nstats\nkill %1\n",
+         match=r".*\ndeadlines pending: 1\n.*"),
+    Case("bg_deadline", "sleep 5 &\nbg --deadline=0.2 %1\nsleep 0.6\njobs\n",
+         match=r"\[1\] \d+ sleep 5 &\n\[1\] \d+ Timed out .*"),
+    # compact takes the width it is asked for
+    Case("pin_compact_width", "pin compact:2\npin compact:2 nproc\npin\n",
+         match=r"%d\npolicy: compact:2\n.*" % min(2, len(os.sched_getaffinity(0)))),
+    Case("pin_compact_bad_width", "pin compact:0\npin compact:x\npin\n", match=r"policy: none\n.*"),
+    # a job stopped in the foreground that then dies without fg is reaped
+    Case("stopped_job_killed_without_fg",
+         "sh -c 'echo $$ > pid; kill -STOP $$'\nsh -c 'kill -9 $(cat pid)'\nsleep 0.3\njobs\necho end\n",
+         out="end\n"),
+    # memo: a hit replays the stored output; a run that is stopped keeps its
+    # output and is still stored once it finishes, whether in fg or bg
+    Case("memo_hit", "memo echo hi\nmemo echo hi\nmemo\n", match=r"hi\nhi\n.*hits 1, misses 1.*"),
+    Case("memo_stopped_fg", "memo sh -c 'echo a; kill -STOP $$; echo b'\necho between\nfg %1\n"
+         "memo sh -c 'echo a; kill -STOP $$; echo b'\nmemo\n",
+         match=r"a\nbetween\nb\na\nb\n.*hits 1, misses 1.*\nstored:    1,.*"),
+    Case("memo_stopped_bg", "memo sh -c 'echo a; kill -STOP $$; echo b'\nbg %1\nsleep 0.3\necho after\n",
+         out="a\nb\nafter\n"),
+    # on-change: runs start from the event loop without printing a job line;
+    # the listing names the running job. The run sees the changed files,
+    # overriding an inherited value.
+    Case("on_change_list", "on-change f.txt -- sleep 1\necho 2 > f.txt\nsleep 0.4\non-change\n",
+         match=r"on-change \[1\] watching 1 directory\n\[1\] f\.txt -- sleep 1  \(queue, 100 ms, 1 runs, running as %\d+\)\n",
+         setup=files(**{"f.txt": "1\n"})),
+    Case("on_change_env", "on-change f.txt -- sh -c 'echo \"got $MYSHELL_CHANGED_FILES\"'\necho 2 > f.txt\nsleep 0.5\necho end\n",
+         out="on-change [1] watching 1 directory\ngot f.txt\nend\n", setup=files(**{"f.txt": "1\n"}),
+         env={"MYSHELL_CHANGED_FILES": "stale"}),
+    # command substitution; a job that stops fails the expansion instead of
+    # hanging the shell
+    Case("subst_basic", "echo \"in $(echo 'a  b')\" $(seq 2) `echo q`\n", out="in a  b 1 2 q\n"),
+    Case("subst_stopped", "echo $(sh -c 'echo x; kill -STOP $$; echo y')\necho next $(seq 3)\njobs\n",
+         out="next 1 2 3\n"),
+    Case("subst_builtin", "cd /\necho \"[$(pwd)]\" $(jobs)\nsleep 1 &\necho \"$(jobs)\" | tr -d 0-9\n",
+         match=r"\[/\]\n\[\d+\] \d+ sleep 1 &\n\[\]  Running  sleep  & &\n"),
+    # raw placeholder bytes in the input are plain text
+    Case("subst_raw_control_bytes", "echo a\x01b $(echo c)\necho a\x019\x02b $(echo c) x\x01y\necho p\x01q\n",
+         out="a\x01b c\na\x019\x02b c x\x01y\np\x01q\n"),
+    # prompt: the layout is a list of known segments
+    Case("prompt_layout", "prompt name status cwd\nprompt bogus\nprompt\n", rc=0,
+         out="layout: name status cwd\nsegments: cwd git jobs load name status\n"),
+    # metrics: counters as Prometheus text; collection can be switched off
+    Case("stats_prom_counters", "true\nfalse\nstats prom\n",
+         match=r".*\nmyshell_commands_total 3\n.*\nmyshell_forks_total 2\n.*"),
+    # a scraper that hangs up before the snapshot is written is dropped; the
+    # shell must not die of SIGPIPE
+    Case("stats_export_client_hangs_up",
+         "stats export unix:x.sock 1\nsleep 0.2\npython3 hangup.py\nsleep 1.2\npython3 hangup.py\npython3 scrape.py\necho alive\n",
+         out="True\nalive\n", setup=files(**{
+             "hangup.py": "import socket\nfor i in range(50):\n"
+                          "    s = socket.socket(socket.AF_UNIX); s.connect('x.sock'); s.close()\n",
+             "scrape.py": "import socket\ns = socket.socket(socket.AF_UNIX); s.connect('x.sock')\ndata = b''\n"
+                          "while True:\n    b = s.recv(65536)\n    if not b: break\n    data += b\n"
+                          "print(b'myshell_commands_total' in data)\n"})),
+    Case("stats_off", "stats off\nstats\n", match=r".*\(collection is off\)\n"),
+    # --trace: a Chrome trace of the session, written at exit
+    Case("trace_export", "echo hi | cat\n", args=["--trace=t.json"], out="hi\n",
+         check=trace_has("line", "parse", "fork", "exec", "wait")),
+    Case("trace_export_script", "", args=["--trace=t.json", "s.msh"], out="hi\n",
+         setup=files(**{"s.msh": "echo hi | cat\n"}), check=trace_has("line", "parse", "fork", "exec", "wait")),
+    # stream mode: scripts and piped stdin; children don't get the stream
+    Case("script_file", "", args=["s.msh"], out="one\ntwo\n", rc=1,
+         setup=files(**{"s.msh": "echo one\n# comment\nfalse\necho two\nfalse\n"})),
+    Case("script_missing", "", args=["nope.msh"], out="", rc=1),
+    Case("stream_many_lines", "".join("echo %d\n" % i for i in range(2000)),
+         out="".join("%d\n" % i for i in range(2000))),
+    Case("stream_stdin_not_inherited", "cat\necho after\n", out="after\n"),
+    # runs happen where the watch was registered, not where the shell is now
+    Case("on_change_registration_cwd",
+         "on-change f.txt -- sh -c 'pwd; cat $MYSHELL_CHANGED_FILES'\ncd sub\necho 2 > ../f.txt\nsleep 0.5\npwd\n",
+         match=r"on-change \[1\] watching 1 directory\n(/\S+)/myshell-test-\w+\n2\n\1/myshell-test-\w+/sub\n",
+         setup=lambda work: (files(**{"f.txt": "1\n"})(work), os.mkdir(os.path.join(work, "sub")))),
+    Case("on_change_memo_refused", "on-change f.txt -- memo cat f.txt\non-change\n", out="", rc=0,
+         setup=files(**{"f.txt": "1\n"})),
+    Case("exec_failure_in_pipeline", "no_such_command_xyz | cat\necho next\n", out="next\n"),
+]
+
+
+def run_case(c, verbose):
+    work = tempfile.mkdtemp(prefix="myshell-test-")
+    try:
+        if c.setup:
+            c.setup(work)
+        env = {"HOME": work, "PATH": os.environ.get("PATH", "/usr/bin:/bin"), "LC_ALL": "C",
+               "MYSHELL_METRICS": "1", **c.env}
+        try:
+            p = subprocess.run([MYSHELL] + c.args, cwd=work, env=env, input=c.script.encode(),
+                               stdout=subprocess.PIPE, stderr=subprocess.PIPE, timeout=c.timeout)
+        except subprocess.TimeoutExpired:
+            return "timed out after %ss" % c.timeout
+        out = p.stdout.decode(errors="replace")
+        problems = []
+        if c.out is not None and out != c.out:
+            problems.append("stdout %r, expected %r" % (out, c.out))
+        if c.match is not None and not re.fullmatch(c.match, out, re.S):
+            problems.append("stdout %r doesn't match %r" % (out, c.match))
+        if p.returncode != c.rc:
+            problems.append("exit status %d, expected %d" % (p.returncode, c.rc))
+        if c.check:
+            problems.append(c.check(work))
+            problems = [x for x in problems if x]
+        if problems and verbose:
+            problems.append("stderr %r" % p.stderr.decode(errors="replace"))
+        return "; ".join(problems)
+    finally:
+        shutil.rmtree(work, ignore_errors=True)
+
+
+def main():
+    ap = argparse.ArgumentParser()
+    ap.add_argument("--filter", default="")
+    ap.add_argument("--slow", action="store_true", help="include cases that take tens of seconds")
+    ap.add_argument("-v", action="store_true")
+    args = ap.parse_args()
+    if not os.access(MYSHELL, os.X_OK):
+        sys.exit("build myshell first (make)")
+    failed = 0
+    cases = [c for c in CASES if args.filter in c.name and (args.slow or not c.slow)]
+    for c in cases:
+        err = run_case(c, args.v)
+        print("%-32s %s" % (c.name, "FAIL: " + err if err else "ok"))
+        failed += bool(err)
+    print("%d/%d passed" % (len(cases) - failed, len(cases)))
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == "__main__":
+    main()
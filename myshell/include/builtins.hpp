@@ -1,4 +1,13 @@
 #pragma once
 #include <string>
 #include <vector>
-// Implemented inside Shell methods; header here for clarity.
+// Builtin name table shared by the dispatcher in Shell and by completion.
+// The builtins themselves are implemented as Shell methods.
+
+enum class Builtin { None, Cd, Pwd, Exit, Jobs, Fg, Bg, Kill, History, Prompt, Stats, Pin, Memo, Capture, OnChange, Timeout };
+
+Builtin builtin_lookup(const std::string& name);
+const std::vector<std::string>& builtin_names();
+// Builtins that only print and leave the shell alone; command substitution
+// runs these in-process instead of forking.
+bool builtin_is_pure(Builtin b);
@@ -0,0 +1,61 @@
+#pragma once
+#include <string>
+#include <mutex>
+#include <cstddef>
+#include <cstdint>
+
+// Fixed-size byte ring on a memfd that is mapped twice back to back, so the
+// buffered bytes are always one contiguous range and writes never need to be
+// split at the wrap point. When full, the oldest bytes are overwritten.
+class RingBuffer {
+public:
+    RingBuffer(size_t capacity, const std::string& name);
+    ~RingBuffer();
+    RingBuffer(const RingBuffer&) = delete;
+    RingBuffer& operator=(const RingBuffer&) = delete;
+
+    bool ok() const { return base != nullptr; }
+    void write(const char* p, size_t n);
+    const char* data() const { return base + (head - used) % cap; }
+    size_t size() const { return used; }
+    size_t capacity() const { return cap; }
+    uint64_t dropped() const { return total - used; }
+    void clear(){ used = 0; total = 0; }
+private:
+    int fd{-1};
+    char* base{nullptr};
+    size_t cap{0};
+    size_t used{0};
+    uint64_t head{0};       // total bytes ever written; write position is head % cap
+    uint64_t total{0};      // bytes written since the last clear()
+};
+
+// Output of one background job: the read end of the pipe its stdout/stderr
+// go to, and the ring the event loop drains it into. In passthrough mode
+// (job in the foreground) the foreground thread copies the ring to the
+// terminal as it fills; the event loop itself never writes to the terminal,
+// so a slow or stopped (^S) terminal can't hold up reaping.
+struct JobOutput {
+    JobOutput(size_t capacity, const std::string& name): ring(capacity, name) {}
+
+    // Reads whatever is available without blocking; false once every writer
+    // has closed the pipe.
+    bool drain();
+    // Writes out and clears the buffer, noting dropped bytes. Blocks on the
+    // terminal, so not for the event loop. True if reading had been paused
+    // on a full ring; the caller watches the pipe again.
+    bool flush();
+    // Replays the buffer to stdout and switches to passthrough.
+    void attach();
+    void detach();
+    // Passthrough output waiting for flush().
+    bool pending();
+    std::string tail(size_t lines);
+
+    std::mutex mtx;
+    RingBuffer ring;
+    int fd{-1};
+    bool passthrough{false};
+    bool paused{false};     // passthrough ring full: pipe not watched until flush()
+    bool eof{false};
+};
@@ -0,0 +1,55 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include "shell.hpp"
+
+struct ParsedLine {
+    std::string line;
+    Pipeline pl;
+};
+
+// Non-interactive command source (piped stdin or a script file). A reader
+// thread pulls the fd in large chunks, splits and parses lines ahead of the
+// executing thread and hands them over in batches, so parsing the next
+// commands overlaps with running the current one. Blank lines and `#`
+// comments are dropped.
+class CommandStream {
+public:
+    explicit CommandStream(int fd);
+    ~CommandStream();
+    // Moves the next batch into `out`; blocks while none is ready. `idle` is
+    // called once before blocking (e.g. to flush output). False at EOF.
+    template <class Idle>
+    bool next(std::vector<ParsedLine>& out, Idle idle){
+        out.clear();
+        std::unique_lock<std::mutex> lk(mtx);
+        if(ready.empty() && !eof){
+            lk.unlock();
+            idle();
+            lk.lock();
+            cv_ready.wait(lk, [&]{ return !ready.empty() || eof; });
+        }
+        if(ready.empty()) return false;
+        out.swap(ready);
+        queued = 0;
+        cv_space.notify_one();
+        return true;
+    }
+private:
+    void run();
+    void publish(std::vector<ParsedLine>& batch);
+
+    static constexpr size_t MAX_QUEUED = 4096;  // parsed lines waiting to run
+    int fd;
+    std::thread th;
+    std::mutex mtx;
+    std::condition_variable cv_ready, cv_space;
+    std::vector<ParsedLine> ready;
+    size_t queued{0};
+    bool eof{false};
+    std::atomic<bool> stop{false};
+};
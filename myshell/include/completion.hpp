@@ -1,4 +1,10 @@
 #pragma once
+#include <string>
+#include <vector>
+
+// Builtins and entries of the current directory starting with `text`.
+std::vector<std::string> completion_candidates(const std::string& text);
+
 #ifdef HAVE_READLINE
 char** myshell_completion(const char* text, int start, int end);
 #endif
@@ -0,0 +1,54 @@
+#pragma once
+#include <vector>
+#include <queue>
+#include <mutex>
+#include <unordered_map>
+#include <cstdint>
+
+// Job deadlines for the event loop: a min-heap of (time, job) behind one
+// timerfd that is always armed for the earliest entry, so thousands of
+// pending deadlines cost one fd and O(log n) per add. Only the latest `seq`
+// per job is live: older entries, and those of cancelled jobs, are dropped
+// when they reach the top or when they outnumber the live ones.
+class Deadlines {
+public:
+    struct Entry {
+        uint64_t when_ns;       // CLOCK_MONOTONIC, as metrics::now_ns()
+        int job_id;
+        uint64_t seq;
+        bool kill;              // second stage: SIGKILL
+        bool operator>(const Entry& o) const { return when_ns > o.when_ns; }
+    };
+
+    Deadlines();
+    ~Deadlines();
+    Deadlines(const Deadlines&) = delete;
+    Deadlines& operator=(const Deadlines&) = delete;
+
+    bool ok() const { return fd >= 0; }
+    int fileno() const { return fd; }
+    // Makes e.seq the job's live deadline.
+    void add(const Entry& e);
+    // The job is gone: forget its entries.
+    void cancel(int job_id);
+    // Consumes the timer expiry and pops every entry that is due.
+    std::vector<Entry> expired();
+    // Entries still to fire, stale ones not counted.
+    size_t size();
+private:
+    // mtx held
+    bool stale(const Entry& e) const;
+    void prune();
+    void arm();
+
+    int fd{-1};
+    std::mutex mtx;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> heap;
+    struct Live {
+        uint64_t seq;
+        size_t entries;                         // in the heap with this seq
+    };
+    std::unordered_map<int, Live> live;         // job id -> its deadline
+    size_t pending{0};                          // sum of live entries
+    uint64_t armed_ns{0};
+};
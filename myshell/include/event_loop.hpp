@@ -0,0 +1,30 @@
+#pragma once
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+
+// epoll-based loop run by the shell's monitor thread. Sources are file
+// descriptors with a handler called on readiness; add/remove may be called
+// from any thread, including from inside a handler. `tick` runs whenever the
+// wait times out, as a fallback for anything that only needs polling.
+class EventLoop {
+public:
+    using Handler = std::function<void(uint32_t events)>;
+
+    EventLoop();
+    ~EventLoop();
+    bool ok() const { return epfd >= 0; }
+    bool add(int fd, uint32_t events, Handler h);
+    void remove(int fd);
+    void run(int tick_ms, const std::function<void()>& tick);
+    void stop();
+private:
+    int epfd{-1};
+    int wakefd{-1};
+    std::atomic<bool> stopped{false};
+    std::mutex mtx;
+    std::map<int, std::shared_ptr<Handler>> handlers;
+};
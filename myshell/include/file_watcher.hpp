@@ -0,0 +1,44 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+
+// inotify watches over a set of paths and globs. A spec is a directory (any
+// change inside counts), a file, or a glob whose last component is matched
+// against file names (`src/*.cpp`); globs in the directory part are expanded
+// once. With `recursive`, directories are watched down the tree (skipping
+// hidden ones) and new subdirectories are picked up as they appear.
+// Relative specs are anchored at `base` and changes under it are reported
+// relative to it, whatever the process cwd is later.
+class FileWatcher {
+public:
+    FileWatcher(bool recursive, const std::string& base);
+    ~FileWatcher();
+    FileWatcher(const FileWatcher&) = delete;
+    FileWatcher& operator=(const FileWatcher&) = delete;
+
+    bool ok() const { return fd >= 0; }
+    int fileno() const { return fd; }
+    bool add(const std::string& spec, std::string& err);
+    size_t watch_count() const { return dirs.size(); }
+    // Drains pending inotify events; adds the paths that matched to `changed`.
+    // If the kernel queue overflowed, events were lost: every watched root
+    // counts as changed and the directory tree is scanned again.
+    void read_events(std::set<std::string>& changed);
+private:
+    struct Filter {
+        std::string root;       // directory the spec was anchored at
+        std::string pattern;    // fnmatch on the file name; empty = everything
+    };
+    bool watch_dir(const std::string& dir, bool descend);
+    bool matches(const std::string& dir, const std::string& name) const;
+    void rescan();
+    std::string relative(const std::string& path) const;
+
+    int fd{-1};
+    bool recursive;
+    std::string base;
+    std::map<int, std::string> dirs;    // watch descriptor -> directory
+    std::vector<Filter> filters;
+};
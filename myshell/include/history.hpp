@@ -1,6 +1,7 @@
 #pragma once
 #include <string>
 #include <vector>
+#include <iosfwd>
 
 class History {
 public:
@@ -8,7 +9,7 @@ public:
     void add(const std::string& line);
     void load();
     void save();
-    void print() const;
+    void print(std::ostream& os) const;
     const std::vector<std::string>& data() const { return lines; }
 private:
     std::string path;
@@ -0,0 +1,80 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <cstdint>
+
+struct Pipeline;
+
+// Identity of a memoized command line. `desc` is the canonical description
+// everything is hashed from (argv, cwd, chosen env vars, executable and input
+// file identities); it is stored with the entry and compared on lookup, so a
+// 64-bit hash collision can only cost a miss.
+struct MemoKey {
+    std::string hex;
+    std::string desc;
+};
+
+// Builds the key for `pl`. Inputs are the `<` redirections plus `inputs`;
+// files up to a size cap are hashed by content, larger ones by size+mtime.
+// Fails (with `err` set) when an input or executable can't be resolved.
+bool memo_key(const Pipeline& pl, const std::vector<std::string>& env, const std::vector<std::string>& inputs,
+              const std::string& cwd, MemoKey& key, std::string& err);
+
+// A cached result: the entry file, open, and where stdout/stderr start in
+// it. The caller replays from `fd` and closes it.
+struct MemoEntry {
+    std::string path;
+    int fd{-1};
+    int status{0};
+    uint64_t out_off{0}, out_len{0}, err_off{0}, err_len{0};
+};
+
+// On-disk store of command results under ~/.cache/myshell/memo, one file per
+// key. Entries are written to a temp file and renamed into place, recency is
+// the file mtime (bumped on every hit), and the total size is kept under
+// `max_bytes` by evicting least recently used entries.
+class MemoStore {
+public:
+    MemoStore(const std::string& dir, uint64_t max_bytes);
+    bool lookup(const MemoKey& key, MemoEntry& out);
+    bool store(const MemoKey& key, int status, int out_fd, int err_fd);
+    void clear();
+    std::string stats();
+    const std::string& directory() const { return dir; }
+    void set_max_bytes(uint64_t n);
+
+    // session counters
+    uint64_t hits{0}, misses{0}, stores{0}, evictions{0}, uncacheable{0};
+private:
+    void scan();
+    void evict();
+    std::string dir;
+    uint64_t max_bytes;
+    bool scanned{false};
+    uint64_t total{0};
+    std::map<std::string, uint64_t> sizes;     // entry file -> bytes
+    std::mutex mtx;
+};
+
+// A memoized run: stdout/stderr go to two scratch files, passed on to `dest`
+// and stderr as they are collected and stored once the job ends. A run that
+// is stopped (^Z) stays attached to its Job until then.
+struct MemoRun {
+    MemoKey key;
+    int out{-1}, err{-1};
+    int dest{-1};                   // -1: stdout
+    uint64_t out_done{0}, err_done{0};
+    bool timeout{false};            // run under `timeout`: 124 is not a result
+
+    MemoRun() = default;
+    MemoRun(const MemoRun&) = delete;
+    MemoRun& operator=(const MemoRun&) = delete;
+    ~MemoRun();
+    // Writes out what arrived since the last call.
+    void pass_on();
+};
+
+// Copies `len` bytes of fd `in` starting at `off` to `fd`.
+bool memo_copy(int in, uint64_t off, uint64_t len, int fd);
@@ -0,0 +1,73 @@
+#pragma once
+#include <string>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+
+// Lightweight shell-internal instrumentation. Counters and latency histograms
+// are kept in per-thread shards (no shared cache lines on the hot path) and
+// only summed up when a snapshot is rendered.
+namespace metrics {
+
+enum Counter : unsigned {
+    Commands, Forks, ForkFailures, ExecFailures, Jobs, LogLines, MemoHits, MemoMisses, Timeouts,
+    CounterCount
+};
+
+enum Hist : unsigned {
+    ParseNs, ForkNs, SpawnNs, WaitNs, LogEnqueueNs, HistoryLoadNs, HistorySaveNs, MemoKeyNs,
+    HistCount
+};
+
+enum Gauge : unsigned {
+    LoggerQueueDepth, LoggerQueueMax,
+    GaugeCount
+};
+
+bool enabled();
+void set_enabled(bool on);
+uint64_t now_ns();
+
+void inc(Counter c, uint64_t n = 1);
+void record(Hist h, uint64_t ns);
+void set_gauge(Gauge g, int64_t v);
+void max_gauge(Gauge g, int64_t v);
+void reset();
+
+std::string render_text();
+std::string render_prometheus();
+
+class ScopedTimer {
+public:
+    explicit ScopedTimer(Hist h): h(h), t0(enabled() ? now_ns() : 0) {}
+    ~ScopedTimer(){ if(t0) record(h, now_ns() - t0); }
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+private:
+    Hist h;
+    uint64_t t0;
+};
+
+} // namespace metrics
+
+// Periodically publishes render_prometheus(): either rewrites a file
+// atomically every interval, or serves the latest snapshot to every client of
+// a local Unix socket ("unix:/path").
+class MetricsExporter {
+public:
+    MetricsExporter(const std::string& target, int interval_ms);
+    ~MetricsExporter();
+    bool ok() const { return good; }
+    const std::string& target() const { return dest; }
+private:
+    void run();
+    void write_file(const std::string& text);
+    std::string dest;
+    std::string sock_path;
+    int interval_ms;
+    int listen_fd{-1};
+    int wake[2]{-1, -1};
+    bool good{false};
+    std::thread th;
+    std::atomic<bool> stop{false};
+};
@@ -0,0 +1,63 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <mutex>
+#include <sched.h>
+
+// CPU/NUMA topology as exposed under /sys/devices/system. Falls back to one
+// node and one cache domain holding every CPU we may run on.
+struct Topology {
+    std::vector<int> cpus;                      // usable CPUs, in topology order
+    std::vector<std::vector<int>> llcs;         // last-level cache domains
+    std::vector<std::vector<int>> nodes;        // NUMA nodes (index = node id)
+    std::vector<int> llc_node;                  // llc index -> node id
+
+    static Topology detect();
+};
+
+enum class PlacementPolicy { None, Spread, Compact, Node };
+
+// What a job was asked for: `pin spread`, `pin node:1`, `pin compact:4`, ...
+struct PlacementSpec {
+    PlacementPolicy policy{PlacementPolicy::None};
+    int node{-1};                               // Node: fixed node, or -1 for least loaded
+    int width{0};                               // Compact: CPUs to use, 0 = from the job's shape
+};
+
+bool parse_placement(const std::string& s, PlacementSpec& out);
+std::string placement_name(const PlacementSpec& spec);
+
+// What a job actually got. Built in the parent so the forked child only has
+// to make the two syscalls in apply_placement().
+struct Placement {
+    PlacementSpec spec;
+    std::vector<int> cpus;                      // empty: not pinned
+    int mem_node{-1};                           // >= 0: memory bound to this node
+    int llc{-1}, node{-1};                      // domain charged in the Placer
+    cpu_set_t mask{};
+
+    std::string describe() const;
+};
+
+// Called in the child between fork and exec, so it sticks to raw syscalls
+// and write(2): no stdio, no allocation.
+void apply_placement(const Placement& p);
+
+// Hands out CPU sets to jobs and keeps per-domain job counts, so spread can
+// pick the least loaded cache domain and compact can fill the first ones.
+class Placer {
+public:
+    Placer();
+    const Topology& topology() const { return topo; }
+    Placement assign(const PlacementSpec& spec, size_t nprocs);
+    void release(const Placement& p);
+private:
+    Topology topo;
+    std::mutex mtx;
+    std::vector<int> llc_jobs;                  // live jobs per llc
+    std::vector<int> node_jobs;                 // live jobs per node
+    std::vector<int> cpu_jobs;                  // live processes per cpu (compact)
+    unsigned rr{0};                             // tie breaker for spread
+};
+
+std::string cpu_list_string(const std::vector<int>& cpus);
@@ -0,0 +1,60 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <memory>
+#include <chrono>
+#include <functional>
+
+class ThreadPool;
+
+// Snapshot of shell state a segment may look at. Built by the shell on every
+// prompt, so it only carries values that are already cached.
+struct PromptContext {
+    std::string cwd;
+    int last_status{0};
+    int bg_jobs{0};
+};
+
+// A named piece of the prompt. Cheap segments render inline; async ones are
+// computed on the thread pool and served from a cache until their ttl expires.
+struct PromptSegment {
+    std::string name;
+    std::function<std::string(const PromptContext&)> render;
+    bool async{false};
+    std::chrono::milliseconds ttl{0};
+    bool per_cwd{false};    // cached value is only valid for the cwd it was computed in
+};
+
+class PromptEngine {
+public:
+    explicit PromptEngine(ThreadPool& pool);
+    void add_segment(PromptSegment seg);
+    bool set_layout(const std::vector<std::string>& names);
+    std::vector<std::string> layout() const;
+    std::vector<std::string> available() const;
+    std::string render(const PromptContext& ctx);
+private:
+    using Clock = std::chrono::steady_clock;
+    struct CacheEntry {
+        std::string key;
+        std::string value;
+        Clock::time_point stamp;
+        bool valid{false};
+        bool pending{false};
+    };
+    struct Cache {
+        std::mutex mtx;
+        std::map<std::string, CacheEntry> entries;
+    };
+    std::string cached(const PromptSegment& seg, const PromptContext& ctx);
+
+    ThreadPool& pool;
+    mutable std::mutex mtx;
+    std::map<std::string, PromptSegment> segments;
+    std::vector<std::string> order;
+    std::shared_ptr<Cache> cache;   // shared with in-flight pool tasks
+};
+
+void register_default_segments(PromptEngine& engine);
@@ -6,10 +6,23 @@
 #include <termios.h>
 #include <sys/types.h>
 #include <mutex>
+#include <condition_variable>
 #include <memory>
+#include <iosfwd>
+#include <thread>
+#include <cstdint>
+#include "placement.hpp"
+
+// `$(...)` / backquotes; argv holds "\x01<index>\x02" where the output goes
+// (and "\x01\x02" for a literal \x01)
+struct Subst {
+    std::string text;
+    bool quoted{false};     // inside "...": no word splitting
+};
 
 struct Command {
     std::vector<std::string> argv;
+    std::vector<Subst> substs;
     std::string in;
     std::string out;
     bool append_out{false};
@@ -22,18 +35,63 @@ struct Pipeline {
 
 enum class JobStatus { Running, Stopped, Done };
 
+struct JobOutput;
+struct MemoRun;
+
+struct Process {
+    pid_t pid;
+    std::string name;
+    uint64_t start_ns{0};
+    int status{0};          // last waitpid status
+    bool done{false};
+    bool stopped{false};
+};
+
 struct Job {
     int id;
     pid_t pgid;
     std::string command;
     JobStatus status;
     bool background{false};
-    std::vector<pid_t> pids;
+    bool waited{false};                 // wait_for_job collects it; otherwise the reaper does once it is done
+    std::vector<Process> procs;
+    Placement placement;
+    std::shared_ptr<JobOutput> output;  // set when stdout/stderr are captured
+    uint64_t deadline_ns{0};            // 0: none
+    uint64_t deadline_seq{0};           // matches the live Deadlines entry
+    uint64_t kill_after_ns{5000000000ull};
+    bool timed_out{false};
+    std::shared_ptr<MemoRun> memo_run;  // memo: a run that was stopped, until the job ends
 };
 
+// Per-job settings gathered from prefix builtins (`pin spread cmd ...`).
+struct JobOptions {
+    PlacementSpec placement;
+    bool memo{false};
+    std::vector<std::string> memo_env;      // memo -e: env vars that are part of the key
+    std::vector<std::string> memo_inputs;   // memo -i: files the command reads
+    int in_fd{-1};                          // if set: stdin of the first stage
+    int out_fd{-1};                         // if set: stdout of the last stage
+    int err_fd{-1};                         // if set: stderr of every stage
+    std::vector<std::string> env;           // extra NAME=value for the children
+    std::string cwd;                        // if set: the children run here, not in the shell's cwd
+    uint64_t timeout_ns{0};                 // timeout: SIGTERM the job after this long
+    uint64_t kill_after_ns{5000000000ull};  // timeout -k: then SIGKILL after this long
+    bool detached{false};                   // no terminal, no wait; the caller calls wait_for_job
+    bool quiet{false};                      // launched off the main thread: no job line, no std::cout
+};
+
+struct ChangeWatch;
+
 class Logger;
 class History;
 class Parser;
+class ThreadPool;
+class PromptEngine;
+class MetricsExporter;
+class MemoStore;
+class EventLoop;
+class Deadlines;
 
 class Shell {
 public:
@@ -47,27 +105,59 @@ private:
     void load_rc();
     std::string prompt();
     std::string read_line();
+    int run_stream(int fd);
     int execute_line(const std::string& line);
-    int launch_pipeline(const Pipeline& pl);
-    int launch_job(const Pipeline& pl, const std::string& printable);
-    int wait_for_job(pid_t pgid);
+    int execute_pipeline(Pipeline& pl);
+    bool take_prefixes(Pipeline& pl, JobOptions& opts);
+    bool expand_substitutions(Pipeline& pl);
+    bool start_subst(const std::string& text, std::string& out, int& fd, pid_t& pgid, int in_fd);
+    int launch_pipeline(const Pipeline& pl, const JobOptions& opts);
+    int launch_job(const Pipeline& pl, const std::string& printable, const JobOptions& opts, pid_t* pgid_out = nullptr);
+    int launch_memoized(const Pipeline& pl, const std::string& printable, const JobOptions& opts);
+    void finish_memo(MemoRun& run, int code);
+    void finish_memo_runs();
+    int wait_for_job(pid_t pgid, const std::shared_ptr<JobOutput>& out = nullptr);
     void update_prompt_jobs_hint();
 
     // builtins
     bool is_builtin(const Command& cmd) const;
-    int run_builtin(const Command& cmd);
+    // `os` is where output-only builtins write: a command substitution passes
+    // its own stream, as std::cout also carries other threads' output
+    int run_builtin(const Command& cmd, std::ostream& os);
     int builtin_cd(const std::vector<std::string>& args);
-    int builtin_pwd();
+    int builtin_pwd(std::ostream& os);
     int builtin_exit();
-    int builtin_jobs();
+    int builtin_jobs(const std::vector<std::string>& args, std::ostream& os);
     int builtin_fg(const std::vector<std::string>& args);
     int builtin_bg(const std::vector<std::string>& args);
     int builtin_kill(const std::vector<std::string>& args);
-    int builtin_history();
+    int builtin_history(std::ostream& os);
+    int builtin_prompt(const std::vector<std::string>& args);
+    int builtin_stats(const std::vector<std::string>& args, std::ostream& os);
+    int builtin_pin(const std::vector<std::string>& args);
+    bool parse_pin_policy(const std::string& s, PlacementSpec& out);
+    Placer& placement();
+    int builtin_memo(const std::vector<std::string>& args);
+    MemoStore& memo_store();
+    int builtin_capture(const std::vector<std::string>& args);
+    std::shared_ptr<JobOutput> open_capture(int job_id, int& write_fd);
+    void watch_output(const std::shared_ptr<JobOutput>& out);
+    void watch_exec(const std::vector<Process>& procs, const std::vector<int>& errpipes, uint64_t spawn_t0);
+    std::shared_ptr<JobOutput> find_output(int id);
+    int add_watch(Pipeline& pl);
+    int builtin_on_change(const std::vector<std::string>& args);
+    bool watch_running(const ChangeWatch& w);
+    void launch_watch(ChangeWatch& w);
+    void fire_watch(ChangeWatch& w);
+    void service_watches();
+    int builtin_timeout(const std::vector<std::string>& args);
+    void set_deadline(Job& job, uint64_t after_ns);
+    void expire_deadlines();
 
     // jobs
     void add_job(const Job& job);
-    void mark_job_status(pid_t pid, int status);
+    void update_process(Job& job, Process& p, int status);
+    void reap_children();
     void check_for_terminated_jobs();
     int next_job_id();
     Job* find_job_by_id(int id);
@@ -85,17 +175,46 @@ private:
     int shell_terminal{-1};
     pid_t shell_pgid{0};
     termios shell_tmodes{};
+    std::string cwd;            // cached; refreshed by builtin_cd
+    int last_status{0};
+    bool stream_log{false};     // --log: log lines read in stream mode too
+    int stream_stdin{-1};       // /dev/null for children while commands come from stdin
 
     // jobs
     mutable std::mutex jobs_mtx;
+    std::condition_variable jobs_cv;   // signalled by the reaper on any process state change
     std::map<int, Job> jobs;       // id -> Job
     std::map<pid_t, int> pgid_to_id;
+    std::map<pid_t, int> pid_to_id;
+    std::map<pid_t, int> unclaimed;    // pid -> status: reaped before add_job registered its job
+    std::map<int, std::shared_ptr<JobOutput>> finished_output;   // last few captured jobs that ended
     std::atomic<int> active_bg_jobs{0};
+    std::unique_ptr<EventLoop> events;  // SIGCHLD self-pipe, captured job output
+    std::thread monitor;                // runs `events`
+    std::unique_ptr<Deadlines> deadlines;   // timeout / --deadline, fired on `events`
+    uint64_t last_deadline_seq{0};
+    std::map<int, Job> timed_out_jobs;  // background jobs killed by their deadline, until listed
+    std::vector<std::pair<std::shared_ptr<MemoRun>, int>> finished_memo;  // run, exit code: see finish_memo_runs
+
+    // on-change watches; their handlers run on the event loop thread
+    std::mutex watch_mtx;
+    std::map<int, std::shared_ptr<ChangeWatch>> watches;
+    int next_watch_id{1};
+
+    // background output capture; read by on-change launches on the event loop
+    std::atomic<bool> capture_bg{false};
+    std::atomic<size_t> capture_bytes{256 << 10};
 
     // i/o + helpers
     std::unique_ptr<Logger> logger;
     std::unique_ptr<History> history;
     std::unique_ptr<Parser> parser;
+    std::unique_ptr<ThreadPool> pool;
+    std::unique_ptr<PromptEngine> prompt_engine;
+    std::unique_ptr<MetricsExporter> exporter;
+    std::unique_ptr<Placer> placer;     // created on first use; reads /sys
+    PlacementSpec default_placement;
+    std::unique_ptr<MemoStore> memo;    // created on first use
 
     // prompt hint
     std::atomic<int> prompt_bg_hint{0};
@@ -0,0 +1,38 @@
+#pragma once
+#include <string>
+#include <cstdint>
+#include "metrics.hpp"
+
+// Timeline recording for --trace=file.json. Each thread appends events to its
+// own chunked buffer without taking locks; the buffers are merged and written
+// as Chrome trace event JSON (chrome://tracing, ui.perfetto.dev) at exit.
+// Timestamps are metrics::now_ns() values.
+namespace trace {
+
+// Track groups, shown as separate "processes" in the viewer.
+enum Group : int { ShellThreads = 1, JobProcesses = 2 };
+
+bool enabled();
+bool start(const std::string& path);
+void finish();
+
+// A finished span on (group, track); track 0 means the calling thread.
+void complete(const char* name, const std::string& detail, uint64_t ts_ns, uint64_t dur_ns,
+              Group group = ShellThreads, int track = 0);
+void name_track(Group group, int track, const std::string& name);
+
+class Span {
+public:
+    explicit Span(const char* name, const std::string& detail = std::string())
+        : name(name), on(enabled()) { if(on){ this->detail = detail; t0 = metrics::now_ns(); } }
+    ~Span(){ if(on) complete(name, detail, t0, metrics::now_ns() - t0); }
+    Span(const Span&) = delete;
+    Span& operator=(const Span&) = delete;
+private:
+    const char* name;
+    bool on;
+    std::string detail;
+    uint64_t t0{0};
+};
+
+} // namespace trace
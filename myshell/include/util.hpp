@@ -1,7 +1,11 @@
 #pragma once
 #include <string>
 #include <vector>
+#include <cstdint>
 
 std::string trim(const std::string& s);
 std::vector<std::string> split_ws(const std::string& s);
 std::string join(const std::vector<std::string>& v, const std::string& sep);
+// "1.5", "30s", "2m", "1h", "1d" -> nanoseconds. False if malformed, negative,
+// inf or nan; huge values are clamped to about 31 years.
+bool parse_duration(const std::string& s, uint64_t& ns);
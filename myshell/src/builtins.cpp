@@ -0,0 +1,38 @@
+#include "builtins.hpp"
+#include <unordered_map>
+#include <algorithm>
+
+static const std::unordered_map<std::string, Builtin>& table(){
+    static const std::unordered_map<std::string, Builtin> t = {
+        {"cd", Builtin::Cd}, {"pwd", Builtin::Pwd}, {"exit", Builtin::Exit},
+        {"jobs", Builtin::Jobs}, {"fg", Builtin::Fg}, {"bg", Builtin::Bg},
+        {"kill", Builtin::Kill}, {"history", Builtin::History},
+        {"prompt", Builtin::Prompt}, {"stats", Builtin::Stats},
+        {"pin", Builtin::Pin}, {"memo", Builtin::Memo},
+        {"capture", Builtin::Capture}, {"on-change", Builtin::OnChange},
+        {"timeout", Builtin::Timeout},
+    };
+    return t;
+}
+
+Builtin builtin_lookup(const std::string& name){
+    auto it = table().find(name);
+    return it==table().end() ? Builtin::None : it->second;
+}
+
+const std::vector<std::string>& builtin_names(){
+    static const std::vector<std::string> names = []{
+        std::vector<std::string> v;
+        for(const auto& [name, b] : table()) v.push_back(name);
+        std::sort(v.begin(), v.end());
+        return v;
+    }();
+    return names;
+}
+
+bool builtin_is_pure(Builtin b){
+    switch(b){
+    case Builtin::Pwd: case Builtin::History: case Builtin::Jobs: case Builtin::Stats: return true;
+    default: return false;
+    }
+}
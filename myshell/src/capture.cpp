@@ -0,0 +1,121 @@
+#include "capture.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <sys/mman.h>
+
+RingBuffer::RingBuffer(size_t capacity, const std::string& name){
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    cap = std::max(page, (capacity + page - 1) / page * page);
+    fd = memfd_create(name.c_str(), MFD_CLOEXEC);
+    if(fd < 0) return;
+    if(ftruncate(fd, cap) != 0) return;
+    void* r = mmap(nullptr, 2*cap, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if(r == MAP_FAILED) return;
+    char* p = (char*)r;
+    if(mmap(p, cap, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FIXED, fd, 0) == MAP_FAILED ||
+       mmap(p + cap, cap, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FIXED, fd, 0) == MAP_FAILED){
+        munmap(p, 2*cap);
+        return;
+    }
+    base = p;
+}
+
+RingBuffer::~RingBuffer(){
+    if(base) munmap(base, 2*cap);
+    if(fd >= 0) close(fd);
+}
+
+void RingBuffer::write(const char* p, size_t n){
+    if(!base) return;
+    total += n;
+    if(n > cap){
+        p += n - cap;
+        head += n - cap;
+        n = cap;
+    }
+    // the second mapping absorbs the part that runs past the end
+    memcpy(base + head % cap, p, n);
+    head += n;
+    used = std::min(cap, used + n);
+}
+
+static void write_all(int fd, const char* p, size_t n){
+    while(n > 0){
+        ssize_t w = ::write(fd, p, n);
+        if(w < 0){
+            if(errno == EINTR) continue;
+            return;
+        }
+        p += w;
+        n -= w;
+    }
+}
+
+bool JobOutput::drain(){
+    std::lock_guard<std::mutex> lk(mtx);
+    if(fd < 0) return false;
+    char buf[65536];
+    // bounded, so one chatty job can't starve the rest of the loop;
+    // epoll is level triggered and brings us back
+    for(int i=0;i<16;++i){
+        // in passthrough nothing may be dropped: only read what fits
+        size_t room = passthrough ? std::min(sizeof(buf), ring.capacity() - ring.size()) : sizeof(buf);
+        if(room == 0) break;
+        ssize_t r = read(fd, buf, room);
+        if(r > 0){
+            ring.write(buf, r);
+            continue;
+        }
+        if(r == 0){ eof = true; return false; }
+        if(errno == EINTR) continue;
+        break;
+    }
+    return true;
+}
+
+bool JobOutput::flush(){
+    std::string out;
+    bool resume;
+    {
+        // copied out, so the event loop can keep draining while we write
+        std::lock_guard<std::mutex> lk(mtx);
+        if(ring.dropped()) out = "[... " + std::to_string(ring.dropped()) + " bytes of earlier output dropped]\n";
+        out.append(ring.data(), ring.size());
+        ring.clear();
+        resume = paused && fd >= 0;
+        paused = false;
+    }
+    write_all(STDOUT_FILENO, out.data(), out.size());
+    return resume;
+}
+
+void JobOutput::attach(){
+    flush();
+    std::lock_guard<std::mutex> lk(mtx);
+    passthrough = true;
+}
+
+bool JobOutput::pending(){
+    std::lock_guard<std::mutex> lk(mtx);
+    return passthrough && ring.size() > 0;
+}
+
+void JobOutput::detach(){
+    std::lock_guard<std::mutex> lk(mtx);
+    passthrough = false;
+}
+
+std::string JobOutput::tail(size_t lines){
+    std::lock_guard<std::mutex> lk(mtx);
+    const char* p = ring.data();
+    size_t n = ring.size(), start = 0;
+    // ignore a trailing newline, then walk back to the start of the n-th last line
+    size_t i = n && p[n-1]=='\n' ? n - 1 : n;
+    while(lines > 0 && i > 0){
+        --i;
+        if(p[i]=='\n' && --lines == 0) start = i + 1;
+    }
+    return std::string(p + start, n - start);
+}
@@ -0,0 +1,81 @@
+#include "command_stream.hpp"
+#include "parser.hpp"
+#include "util.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+CommandStream::CommandStream(int fd): fd(fd){
+    th = std::thread([this]{ run(); });
+}
+
+CommandStream::~CommandStream(){
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        stop = true;
+    }
+    cv_space.notify_all();
+    th.join();
+}
+
+void CommandStream::publish(std::vector<ParsedLine>& batch){
+    if(batch.empty()) return;
+    std::unique_lock<std::mutex> lk(mtx);
+    cv_space.wait(lk, [&]{ return queued < MAX_QUEUED || stop; });
+    if(ready.empty()) ready.swap(batch);
+    else{
+        for(auto& p: batch) ready.push_back(std::move(p));
+    }
+    queued = ready.size();
+    batch.clear();
+    cv_ready.notify_one();
+}
+
+void CommandStream::run(){
+    trace::name_track(trace::ShellThreads, 0, "reader");
+    Parser parser;
+    std::vector<char> buf(1 << 16);
+    std::string partial;
+    std::vector<ParsedLine> batch;
+    auto take = [&](const char* s, size_t n){
+        std::string line = trim(std::string(s, n));
+        if(line.empty() || line[0]=='#') return;
+        ParsedLine p;
+        {
+            metrics::ScopedTimer t(metrics::ParseNs);
+            trace::Span ps("parse");        // on the reader's track, ahead of its "line"
+            p.pl = parser.parse(line);
+        }
+        p.line = std::move(line);
+        batch.push_back(std::move(p));
+        if(batch.size() >= 256) publish(batch);
+    };
+    while(!stop){
+        ssize_t r = read(fd, buf.data(), buf.size());
+        if(r < 0 && errno == EINTR) continue;
+        if(r <= 0) break;
+        const char* p = buf.data();
+        const char* end = p + r;
+        while(p < end){
+            const char* nl = (const char*)memchr(p, '\n', end - p);
+            if(!nl){ partial.append(p, end - p); break; }
+            if(partial.empty()) take(p, nl - p);
+            else{
+                partial.append(p, nl - p);
+                take(partial.data(), partial.size());
+                partial.clear();
+            }
+            p = nl + 1;
+        }
+        // hand over at every chunk boundary: a producer waiting on our
+        // output must not have its command sit in a half-full batch
+        publish(batch);
+    }
+    if(!partial.empty()) take(partial.data(), partial.size());
+    publish(batch);
+    std::lock_guard<std::mutex> lk(mtx);
+    eof = true;
+    cv_ready.notify_all();
+}
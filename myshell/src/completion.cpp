@@ -1,25 +1,11 @@
 #include "completion.hpp"
-#ifdef HAVE_READLINE
-#include <readline/readline.h>
-#include <readline/history.h>
-#include <vector>
-#include <string>
+#include "builtins.hpp"
 #include <filesystem>
 
-static const char* builtins[] = {"cd","pwd","exit","jobs","fg","bg","kill","history",nullptr};
-
-static char* dupstr(const std::string& s) {
-    char* r = (char*)malloc(s.size()+1);
-    std::copy(s.begin(), s.end(), r);
-    r[s.size()] = '\0';
-    return r;
-}
-
-static std::vector<std::string> candidates(const std::string& text){
+std::vector<std::string> completion_candidates(const std::string& text){
     std::vector<std::string> cand;
     // builtins
-    for(int i=0; builtins[i]; ++i){
-        std::string b = builtins[i];
+    for(const auto& b: builtin_names()){
         if(b.rfind(text, 0) == 0) cand.push_back(b);
     }
     // files/dirs
@@ -32,11 +18,23 @@ static std::vector<std::string> candidates(const std::string& text){
     return cand;
 }
 
+#ifdef HAVE_READLINE
+#include <readline/readline.h>
+#include <readline/history.h>
+#include <cstdlib>
+
+static char* dupstr(const std::string& s) {
+    char* r = (char*)malloc(s.size()+1);
+    std::copy(s.begin(), s.end(), r);
+    r[s.size()] = '\0';
+    return r;
+}
+
 static char* generator(const char* text, int state){
     static std::vector<std::string> cand;
     static size_t idx;
     if(state == 0){
-        cand = candidates(text);
+        cand = completion_candidates(text);
         idx = 0;
     }
     if(idx < cand.size()){
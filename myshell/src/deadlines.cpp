@@ -0,0 +1,88 @@
+#include "deadlines.hpp"
+#include "metrics.hpp"
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+Deadlines::Deadlines(){
+    fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+}
+
+Deadlines::~Deadlines(){
+    if(fd >= 0) close(fd);
+}
+
+bool Deadlines::stale(const Entry& e) const {
+    auto it = live.find(e.job_id);
+    return it == live.end() || it->second.seq != e.seq;
+}
+
+// Drops stale entries from the top, and rebuilds the heap once they make up
+// most of it, so finished jobs don't pile up behind a far-off deadline.
+void Deadlines::prune(){
+    while(!heap.empty() && stale(heap.top())) heap.pop();
+    if(heap.size() <= 2 * pending + 16) return;
+    std::vector<Entry> keep;
+    while(!heap.empty()){
+        if(!stale(heap.top())) keep.push_back(heap.top());
+        heap.pop();
+    }
+    for(const auto& e: keep) heap.push(e);
+}
+
+void Deadlines::arm(){
+    prune();
+    uint64_t next = heap.empty() ? 0 : heap.top().when_ns;
+    if(next == armed_ns) return;
+    itimerspec its{};      // all zero disarms
+    its.it_value.tv_sec = next / 1000000000ull;
+    its.it_value.tv_nsec = next % 1000000000ull;
+    timerfd_settime(fd, TFD_TIMER_ABSTIME, &its, nullptr);
+    armed_ns = next;
+}
+
+void Deadlines::add(const Entry& e){
+    std::lock_guard<std::mutex> lk(mtx);
+    auto it = live.find(e.job_id);
+    if(it == live.end()) it = live.emplace(e.job_id, Live{e.seq, 0}).first;
+    if(it->second.seq != e.seq){
+        pending -= it->second.entries;      // re-armed: the old ones are stale
+        it->second = {e.seq, 0};
+    }
+    ++it->second.entries;
+    ++pending;
+    heap.push(e);
+    arm();
+}
+
+void Deadlines::cancel(int job_id){
+    std::lock_guard<std::mutex> lk(mtx);
+    auto it = live.find(job_id);
+    if(it == live.end()) return;
+    pending -= it->second.entries;
+    live.erase(it);
+    arm();
+}
+
+std::vector<Deadlines::Entry> Deadlines::expired(){
+    uint64_t n;
+    (void)!read(fd, &n, sizeof(n));
+    std::vector<Entry> out;
+    std::lock_guard<std::mutex> lk(mtx);
+    uint64_t now = metrics::now_ns();
+    while(!heap.empty() && heap.top().when_ns <= now){
+        if(!stale(heap.top())){
+            out.push_back(heap.top());
+            --live[heap.top().job_id].entries;
+            --pending;
+        }
+        heap.pop();
+    }
+    armed_ns = 0;
+    arm();
+    return out;
+}
+
+size_t Deadlines::size(){
+    std::lock_guard<std::mutex> lk(mtx);
+    return pending;
+}
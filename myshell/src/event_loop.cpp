@@ -0,0 +1,71 @@
+#include "event_loop.hpp"
+#include <cerrno>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+EventLoop::EventLoop(){
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    wakefd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+    if(epfd < 0 || wakefd < 0) return;
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = wakefd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, wakefd, &ev);
+}
+
+EventLoop::~EventLoop(){
+    if(epfd >= 0) close(epfd);
+    if(wakefd >= 0) close(wakefd);
+}
+
+bool EventLoop::add(int fd, uint32_t events, Handler h){
+    std::lock_guard<std::mutex> lk(mtx);
+    epoll_event ev{};
+    ev.events = events;
+    ev.data.fd = fd;
+    if(epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) != 0) return false;
+    handlers[fd] = std::make_shared<Handler>(std::move(h));
+    return true;
+}
+
+void EventLoop::remove(int fd){
+    std::lock_guard<std::mutex> lk(mtx);
+    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+    handlers.erase(fd);
+}
+
+void EventLoop::run(int tick_ms, const std::function<void()>& tick){
+    epoll_event evs[32];
+    while(!stopped){
+        int n = epoll_wait(epfd, evs, 32, tick_ms);
+        if(n < 0){
+            if(errno == EINTR) continue;
+            break;
+        }
+        if(n == 0){ tick(); continue; }
+        for(int i=0;i<n;++i){
+            int fd = evs[i].data.fd;
+            if(fd == wakefd){
+                uint64_t v;
+                (void)!read(wakefd, &v, sizeof(v));
+                continue;
+            }
+            // copy the handler out so it may remove itself (or others)
+            std::shared_ptr<Handler> h;
+            {
+                std::lock_guard<std::mutex> lk(mtx);
+                auto it = handlers.find(fd);
+                if(it == handlers.end()) continue;
+                h = it->second;
+            }
+            (*h)(evs[i].events);
+        }
+    }
+}
+
+void EventLoop::stop(){
+    stopped = true;
+    uint64_t one = 1;
+    (void)!write(wakefd, &one, sizeof(one));
+}
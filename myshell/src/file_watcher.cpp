@@ -0,0 +1,145 @@
+#include "file_watcher.hpp"
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <fnmatch.h>
+#include <glob.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+static constexpr uint32_t WATCH_MASK = IN_CLOSE_WRITE|IN_MOVED_TO|IN_MOVED_FROM|IN_CREATE|IN_DELETE;
+
+static bool has_glob(const std::string& s){
+    return s.find_first_of("*?[") != std::string::npos;
+}
+
+FileWatcher::FileWatcher(bool recursive, const std::string& base): recursive(recursive), base(base){
+    fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+}
+
+FileWatcher::~FileWatcher(){
+    if(fd >= 0) close(fd);
+}
+
+bool FileWatcher::watch_dir(const std::string& dir, bool descend){
+    int wd = inotify_add_watch(fd, dir.c_str(), WATCH_MASK|IN_ONLYDIR);
+    if(wd < 0) return false;
+    dirs[wd] = dir;
+    if(!descend) return true;
+    std::error_code ec;
+    for(const auto& e: std::filesystem::directory_iterator(dir, ec)){
+        std::string name = e.path().filename();
+        if(name.empty() || name[0]=='.') continue;
+        if(e.is_directory(ec) && !e.is_symlink(ec)) watch_dir(e.path().string(), true);
+    }
+    return true;
+}
+
+std::string FileWatcher::relative(const std::string& path) const{
+    if(path == base) return ".";
+    if(base != "/" && path.compare(0, base.size() + 1, base + "/") == 0) return path.substr(base.size() + 1);
+    if(base == "/" && !path.empty() && path[0] == '/') return path.substr(1);
+    return path;
+}
+
+bool FileWatcher::add(const std::string& spec, std::string& err){
+    std::string path = std::filesystem::path(base).append(spec).lexically_normal().string();
+    while(path.size() > 1 && path.back()=='/') path.pop_back();
+    size_t slash = path.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+    std::string last = slash == std::string::npos ? path : path.substr(slash + 1);
+
+    std::vector<std::string> roots;
+    std::string pattern;
+    struct stat st;
+    if(!has_glob(path)){
+        if(stat(path.c_str(), &st) != 0){ err = spec + ": " + strerror(errno); return false; }
+        if(S_ISDIR(st.st_mode)) roots.push_back(path);
+        else{
+            // watch the directory, not the inode: editors save by renaming
+            roots.push_back(dir);
+            pattern = last;
+        }
+    }else{
+        pattern = last;
+        if(has_glob(dir)){
+            glob_t g{};
+            if(glob(dir.c_str(), GLOB_ONLYDIR, nullptr, &g) == 0){
+                for(size_t i=0;i<g.gl_pathc;++i) roots.push_back(g.gl_pathv[i]);
+            }
+            globfree(&g);
+        }else roots.push_back(dir);
+        if(roots.empty()){ err = spec + ": no matching directories"; return false; }
+    }
+    for(const auto& r: roots){
+        if(!watch_dir(r, recursive)){
+            err = relative(r) + ": " + strerror(errno);
+            return false;
+        }
+        filters.push_back({r, pattern});
+    }
+    return true;
+}
+
+bool FileWatcher::matches(const std::string& dir, const std::string& name) const{
+    for(const auto& f: filters){
+        bool under = dir == f.root || (recursive && dir.compare(0, f.root.size() + 1, f.root + "/") == 0);
+        if(!under) continue;
+        if(f.pattern.empty() || fnmatch(f.pattern.c_str(), name.c_str(), 0) == 0) return true;
+    }
+    return false;
+}
+
+// After an overflow: drop watches on directories that went away and pick
+// up subdirectories created while events were being lost.
+void FileWatcher::rescan(){
+    struct stat st;
+    for(auto it = dirs.begin(); it != dirs.end();){
+        if(stat(it->second.c_str(), &st) == 0 && S_ISDIR(st.st_mode)){ ++it; continue; }
+        inotify_rm_watch(fd, it->first);
+        it = dirs.erase(it);
+    }
+    if(!recursive) return;
+    for(const auto& f: filters) watch_dir(f.root, true);
+}
+
+void FileWatcher::read_events(std::set<std::string>& changed){
+    alignas(inotify_event) char buf[16384];
+    bool overflow = false;
+    while(true){
+        ssize_t r = read(fd, buf, sizeof(buf));
+        if(r <= 0){
+            if(r < 0 && errno == EINTR) continue;
+            break;
+        }
+        for(char* p = buf; p < buf + r;){
+            auto* ev = (inotify_event*)p;
+            p += sizeof(inotify_event) + ev->len;
+            if(ev->mask & IN_Q_OVERFLOW){
+                overflow = true;
+                continue;
+            }
+            auto it = dirs.find(ev->wd);
+            if(ev->mask & IN_IGNORED){
+                if(it != dirs.end()) dirs.erase(it);
+                continue;
+            }
+            if(it == dirs.end() || ev->len == 0) continue;
+            std::string dir = it->second;
+            std::string name = ev->name;
+            if((ev->mask & IN_ISDIR) && (ev->mask & (IN_CREATE|IN_MOVED_TO)) && recursive && name[0] != '.'){
+                watch_dir(dir + "/" + name, true);
+                continue;
+            }
+            // IN_CREATE is only wanted for new directories; a new file also
+            // reports IN_CLOSE_WRITE once it has been written
+            if(ev->mask & (IN_ISDIR|IN_CREATE)) continue;
+            if(matches(dir, name)) changed.insert(relative(dir + "/" + name));
+        }
+    }
+    if(overflow){
+        rescan();
+        for(const auto& f: filters) changed.insert(relative(f.root));
+    }
+}
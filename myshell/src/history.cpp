@@ -1,4 +1,5 @@
 #include "history.hpp"
+#include "metrics.hpp"
 #include <iostream>
 #include <cstdlib>
 #include <fstream>
@@ -15,6 +16,7 @@ void History::add(const std::string& line){
 }
 
 void History::load(){
+    metrics::ScopedTimer t(metrics::HistoryLoadNs);
     std::ifstream ifs(path);
     std::string s;
     while(std::getline(ifs, s)){
@@ -23,13 +25,14 @@ void History::load(){
 }
 
 void History::save(){
+    metrics::ScopedTimer t(metrics::HistorySaveNs);
     std::ofstream ofs(path, std::ios::app);
     for(const auto& s: lines) ofs << s << "\n";
     lines.clear();
 }
 
-void History::print() const{
+void History::print(std::ostream& os) const{
     for(size_t i=0;i<lines.size();++i){
-        std::cout << (i+1) << "  " << lines[i] << "\n";
+        os << (i+1) << "  " << lines[i] << "\n";
     }
 }
@@ -1,4 +1,5 @@
 #include "logger.hpp"
+#include "metrics.hpp"
 #include <chrono>
 #include <iomanip>
 
@@ -13,9 +14,14 @@ Logger::~Logger(){
 }
 
 void Logger::log(const std::string& line){
+    metrics::ScopedTimer t(metrics::LogEnqueueNs);
     std::unique_lock<std::mutex> lk(mtx);
     q.push(line);
+    metrics::set_gauge(metrics::LoggerQueueDepth, (int64_t)q.size());
+    metrics::max_gauge(metrics::LoggerQueueMax, (int64_t)q.size());
     cv.notify_one();
+    lk.unlock();
+    metrics::inc(metrics::LogLines);
 }
 
 void Logger::run(){
@@ -25,6 +31,7 @@ void Logger::run(){
         cv.wait(lk, [&]{ return stop || !q.empty(); });
         if(stop && q.empty()) break;
         auto s = q.front(); q.pop();
+        metrics::set_gauge(metrics::LoggerQueueDepth, (int64_t)q.size());
         lk.unlock();
         // timestamp
         auto now = std::chrono::system_clock::now();
@@ -0,0 +1,320 @@
+#include "memo.hpp"
+#include "shell.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <sstream>
+#include <filesystem>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+static constexpr uint64_t FNV_OFFSET = 1469598103934665603ull;
+static constexpr uint64_t FNV_PRIME = 1099511628211ull;
+static constexpr off_t CONTENT_HASH_MAX = 64ll << 20;   // bigger inputs are identified by size+mtime
+
+static uint64_t fnv1a(const void* data, size_t n, uint64_t h = FNV_OFFSET){
+    const unsigned char* p = (const unsigned char*)data;
+    for(size_t i=0;i<n;++i){ h ^= p[i]; h *= FNV_PRIME; }
+    return h;
+}
+
+static std::string hex64(uint64_t v){
+    char buf[17];
+    snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)v);
+    return buf;
+}
+
+static uint64_t mtime_ns(const struct stat& st){
+    return (uint64_t)st.st_mtim.tv_sec * 1000000000ull + st.st_mtim.tv_nsec;
+}
+
+// Length-prefixed so argv {"a b"} and {"a", "b"} describe differently.
+static void put(std::string& d, const std::string& s){
+    d += std::to_string(s.size());
+    d += ':';
+    d += s;
+    d += '\n';
+}
+
+static bool resolve_exe(const std::string& name, std::string& path){
+    if(name.find('/') != std::string::npos){
+        path = name;
+        return access(name.c_str(), X_OK) == 0;
+    }
+    const char* p = std::getenv("PATH");
+    std::string dirs = p ? p : "/usr/bin:/bin";
+    size_t start = 0;
+    while(start <= dirs.size()){
+        size_t end = dirs.find(':', start);
+        if(end == std::string::npos) end = dirs.size();
+        std::string dir = dirs.substr(start, end - start);
+        std::string cand = (dir.empty() ? "." : dir) + "/" + name;
+        struct stat st;
+        if(stat(cand.c_str(), &st) == 0 && S_ISREG(st.st_mode) && access(cand.c_str(), X_OK) == 0){
+            path = cand;
+            return true;
+        }
+        start = end + 1;
+    }
+    return false;
+}
+
+static bool describe_file(const std::string& path, bool hash_content, std::string& d){
+    struct stat st;
+    if(stat(path.c_str(), &st) != 0) return false;
+    d += std::to_string((unsigned long long)st.st_dev) + " " + std::to_string((unsigned long long)st.st_ino) + " ";
+    d += std::to_string((long long)st.st_size) + " ";
+    if(!hash_content || !S_ISREG(st.st_mode) || st.st_size > CONTENT_HASH_MAX){
+        d += "mtime " + std::to_string(mtime_ns(st)) + "\n";
+        return true;
+    }
+    int fd = open(path.c_str(), O_RDONLY|O_CLOEXEC);
+    if(fd < 0) return false;
+    uint64_t h = FNV_OFFSET;
+    char buf[65536];
+    ssize_t r;
+    while((r = read(fd, buf, sizeof(buf))) > 0) h = fnv1a(buf, r, h);
+    close(fd);
+    if(r < 0) return false;
+    d += "fnv " + hex64(h) + "\n";
+    return true;
+}
+
+bool memo_key(const Pipeline& pl, const std::vector<std::string>& env, const std::vector<std::string>& inputs,
+              const std::string& cwd, MemoKey& key, std::string& err){
+    std::string d = "cwd ";
+    put(d, cwd);
+    for(const auto& c: pl.cmds){
+        d += "cmd " + std::to_string(c.argv.size()) + "\n";
+        for(const auto& a: c.argv) put(d, a);
+        std::string exe;
+        if(!resolve_exe(c.argv[0], exe)){ err = c.argv[0] + ": command not found"; return false; }
+        d += "exe ";
+        put(d, exe);
+        // the binary's identity, not its bytes: hashing every executable on
+        // every lookup would cost more than most of the commands we cache
+        if(!describe_file(exe, false, d)){ err = exe + ": " + strerror(errno); return false; }
+        if(!c.in.empty()){
+            d += "in ";
+            put(d, c.in);
+            if(!describe_file(c.in, true, d)){ err = c.in + ": " + strerror(errno); return false; }
+        }
+    }
+    for(const auto& name: env){
+        const char* v = std::getenv(name.c_str());
+        d += "env ";
+        put(d, name);
+        d += v ? "=" + std::to_string(strlen(v)) + ":" + v + "\n" : "unset\n";
+    }
+    for(const auto& in: inputs){
+        d += "input ";
+        put(d, in);
+        if(!describe_file(in, true, d)){ err = in + ": " + strerror(errno); return false; }
+    }
+    key.desc = d;
+    key.hex = hex64(fnv1a(d.data(), d.size()));
+    return true;
+}
+
+// Entry file layout:
+//   myshell-memo 1\n <desc length>\n <desc>\n <status> <stdout length> <stderr length>\n <stdout><stderr>
+static const char* MAGIC = "myshell-memo 1";
+
+MemoStore::MemoStore(const std::string& dir, uint64_t max_bytes): dir(dir), max_bytes(max_bytes){
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+}
+
+void MemoStore::set_max_bytes(uint64_t n){
+    std::lock_guard<std::mutex> lk(mtx);
+    max_bytes = n;
+    scan();
+    evict();
+}
+
+// mtx must be held
+void MemoStore::scan(){
+    std::error_code ec;
+    sizes.clear();
+    total = 0;
+    for(const auto& e: std::filesystem::directory_iterator(dir, ec)){
+        std::string name = e.path().filename();
+        if(name.size() < 6 || name.compare(name.size() - 6, 6, ".entry") != 0) continue;
+        uint64_t sz = e.file_size(ec);
+        if(ec) continue;
+        sizes[e.path().string()] = sz;
+        total += sz;
+    }
+    scanned = true;
+}
+
+// mtx must be held. Other shells share the directory, so rescan before
+// deciding what to drop.
+void MemoStore::evict(){
+    if(total <= max_bytes) return;
+    scan();
+    std::vector<std::pair<uint64_t, std::string>> by_age;
+    for(const auto& [path, sz] : sizes){
+        struct stat st;
+        if(stat(path.c_str(), &st) == 0) by_age.push_back({mtime_ns(st), path});
+    }
+    std::sort(by_age.begin(), by_age.end());
+    for(const auto& [age, path] : by_age){
+        if(total <= max_bytes) break;
+        if(unlink(path.c_str()) == 0 || errno == ENOENT){
+            total -= sizes[path];
+            sizes.erase(path);
+            ++evictions;
+        }
+    }
+}
+
+bool MemoStore::lookup(const MemoKey& key, MemoEntry& out){
+    std::lock_guard<std::mutex> lk(mtx);
+    std::string path = dir + "/" + key.hex + ".entry";
+    // everything below reads this one open file, so a store() renaming a new
+    // entry into place can't pair this header with another file's body
+    int fd = open(path.c_str(), O_RDONLY|O_CLOEXEC);
+    std::string head(fd >= 0 ? key.desc.size() + 128 : 0, '\0');
+    ssize_t r = fd >= 0 ? pread(fd, &head[0], head.size(), 0) : -1;
+    head.resize(r > 0 ? r : 0);
+    std::istringstream is(head);
+    std::string line;
+    size_t dlen = 0;
+    bool ok = std::getline(is, line) && line == MAGIC && (is >> dlen) && is.get() == '\n';
+    if(ok && dlen == key.desc.size()){
+        std::string desc(dlen, '\0');
+        is.read(&desc[0], dlen);
+        ok = is && desc == key.desc && is.get() == '\n' &&
+             (is >> out.status >> out.out_len >> out.err_len) && is.get() == '\n';
+    }else ok = false;
+    struct stat st;
+    if(ok){
+        out.out_off = (uint64_t)is.tellg();
+        out.err_off = out.out_off + out.out_len;
+        ok = fstat(fd, &st) == 0 && (uint64_t)st.st_size >= out.err_off + out.err_len;
+    }
+    if(!ok){
+        if(fd >= 0) close(fd);
+        ++misses;
+        return false;
+    }
+    out.path = path;
+    out.fd = fd;
+    futimens(fd, nullptr);      // LRU: a hit makes it recent
+    ++hits;
+    return true;
+}
+
+static bool copy_fd(int from, int to, uint64_t* copied){
+    if(lseek(from, 0, SEEK_SET) < 0) return false;
+    char buf[65536];
+    ssize_t r;
+    while((r = read(from, buf, sizeof(buf))) > 0){
+        for(ssize_t w = 0; w < r;){
+            ssize_t k = write(to, buf + w, r - w);
+            if(k < 0){ if(errno == EINTR) continue; return false; }
+            w += k;
+        }
+        *copied += r;
+    }
+    return r == 0;
+}
+
+bool MemoStore::store(const MemoKey& key, int status, int out_fd, int err_fd){
+    std::lock_guard<std::mutex> lk(mtx);
+    if(!scanned) scan();
+    struct stat so, se;
+    if(fstat(out_fd, &so) != 0 || fstat(err_fd, &se) != 0) return false;
+    if((uint64_t)(so.st_size + se.st_size) > max_bytes) return false;
+
+    std::string tmp = dir + "/.tmp-XXXXXX";
+    int fd = mkstemp(&tmp[0]);
+    if(fd < 0) return false;
+    std::string head = std::string(MAGIC) + "\n" + std::to_string(key.desc.size()) + "\n" + key.desc + "\n" +
+                       std::to_string(status) + " " + std::to_string((long long)so.st_size) + " " +
+                       std::to_string((long long)se.st_size) + "\n";
+    uint64_t n = 0;
+    bool ok = write(fd, head.data(), head.size()) == (ssize_t)head.size() &&
+              copy_fd(out_fd, fd, &n) && copy_fd(err_fd, fd, &n) &&
+              n == (uint64_t)(so.st_size + se.st_size);
+    ok = close(fd) == 0 && ok;
+    std::string path = dir + "/" + key.hex + ".entry";
+    if(!ok || rename(tmp.c_str(), path.c_str()) != 0){
+        unlink(tmp.c_str());
+        return false;
+    }
+    uint64_t sz = head.size() + n;
+    auto it = sizes.find(path);
+    if(it != sizes.end()) total -= it->second;
+    sizes[path] = sz;
+    total += sz;
+    ++stores;
+    evict();
+    return true;
+}
+
+void MemoStore::clear(){
+    std::lock_guard<std::mutex> lk(mtx);
+    scan();
+    for(const auto& [path, sz] : sizes) unlink(path.c_str());
+    sizes.clear();
+    total = 0;
+}
+
+std::string MemoStore::stats(){
+    std::lock_guard<std::mutex> lk(mtx);
+    scan();
+    char buf[512];
+    uint64_t lookups = hits + misses;
+    snprintf(buf, sizeof(buf),
+             "store:     %s\n"
+             "entries:   %zu (%.1f MiB of %.1f MiB)\n"
+             "lookups:   %llu (hits %llu, misses %llu, hit rate %.1f%%)\n"
+             "stored:    %llu, evicted %llu, uncacheable %llu\n",
+             dir.c_str(), sizes.size(), total / 1048576.0, max_bytes / 1048576.0,
+             (unsigned long long)lookups, (unsigned long long)hits, (unsigned long long)misses,
+             lookups ? 100.0 * hits / lookups : 0.0,
+             (unsigned long long)stores, (unsigned long long)evictions, (unsigned long long)uncacheable);
+    return buf;
+}
+
+bool memo_copy(int in, uint64_t off, uint64_t len, int fd){
+    char buf[65536];
+    while(len > 0){
+        ssize_t r = pread(in, buf, std::min<uint64_t>(len, sizeof(buf)), off);
+        if(r <= 0) break;
+        for(ssize_t w = 0; w < r;){
+            ssize_t k = write(fd, buf + w, r - w);
+            if(k < 0){
+                if(errno == EINTR) continue;
+                return false;
+            }
+            w += k;
+        }
+        off += r;
+        len -= r;
+    }
+    return len == 0;
+}
+
+MemoRun::~MemoRun(){
+    if(out >= 0) close(out);
+    if(err >= 0) close(err);
+    if(dest >= 0) close(dest);
+}
+
+void MemoRun::pass_on(){
+    struct stat so{}, se{};
+    if(fstat(out, &so) == 0 && (uint64_t)so.st_size > out_done){
+        memo_copy(out, out_done, so.st_size - out_done, dest >= 0 ? dest : STDOUT_FILENO);
+        out_done = so.st_size;
+    }
+    if(fstat(err, &se) == 0 && (uint64_t)se.st_size > err_done){
+        memo_copy(err, err_done, se.st_size - err_done, STDERR_FILENO);
+        err_done = se.st_size;
+    }
+}
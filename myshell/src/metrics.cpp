@@ -0,0 +1,315 @@
+#include "metrics.hpp"
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+namespace metrics {
+
+// HDR-style log-linear buckets: values below 16 get their own bucket, above
+// that every power of two is split into 16 sub-buckets (~6% precision).
+static constexpr unsigned SUB_BITS = 4;
+static constexpr unsigned SUB = 1u << SUB_BITS;
+static constexpr unsigned BUCKETS = (64 - SUB_BITS + 1) * SUB;
+
+static unsigned bucket_of(uint64_t v){
+    if(v < SUB) return (unsigned)v;
+    unsigned msb = 63 - __builtin_clzll(v);
+    return (msb - SUB_BITS + 1) * SUB + (unsigned)((v >> (msb - SUB_BITS)) & (SUB - 1));
+}
+
+static uint64_t bucket_upper(unsigned idx){
+    if(idx < SUB) return idx;
+    unsigned row = idx / SUB + SUB_BITS - 1;
+    uint64_t sub = idx % SUB;
+    return ((SUB + sub + 1) << (row - SUB_BITS)) - 1;
+}
+
+struct Histogram {
+    std::atomic<uint64_t> buckets[BUCKETS];
+    std::atomic<uint64_t> count{0}, sum{0}, max{0};
+    Histogram(){ for(auto& b: buckets) b.store(0, std::memory_order_relaxed); }
+};
+
+struct alignas(64) Shard {
+    std::atomic<uint64_t> counters[CounterCount];
+    Histogram hists[HistCount];
+    Shard(){ for(auto& c: counters) c.store(0, std::memory_order_relaxed); }
+};
+
+static std::atomic<bool> g_enabled{true};
+static std::mutex g_mtx;
+static std::vector<std::unique_ptr<Shard>> g_shards;   // never shrinks; shards outlive their threads
+static std::atomic<int64_t> g_gauges[GaugeCount];
+
+static Shard& shard(){
+    thread_local Shard* s = nullptr;
+    if(!s){
+        auto p = std::make_unique<Shard>();
+        s = p.get();
+        std::lock_guard<std::mutex> lk(g_mtx);
+        g_shards.push_back(std::move(p));
+    }
+    return *s;
+}
+
+bool enabled(){ return g_enabled.load(std::memory_order_relaxed); }
+void set_enabled(bool on){ g_enabled.store(on); }
+
+uint64_t now_ns(){
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void inc(Counter c, uint64_t n){
+    if(!enabled()) return;
+    shard().counters[c].fetch_add(n, std::memory_order_relaxed);
+}
+
+void record(Hist h, uint64_t ns){
+    if(!enabled()) return;
+    auto& hg = shard().hists[h];
+    hg.buckets[bucket_of(ns)].fetch_add(1, std::memory_order_relaxed);
+    hg.count.fetch_add(1, std::memory_order_relaxed);
+    hg.sum.fetch_add(ns, std::memory_order_relaxed);
+    if(ns > hg.max.load(std::memory_order_relaxed)) hg.max.store(ns, std::memory_order_relaxed);
+}
+
+void set_gauge(Gauge g, int64_t v){
+    if(!enabled()) return;
+    g_gauges[g].store(v, std::memory_order_relaxed);
+}
+
+void max_gauge(Gauge g, int64_t v){
+    if(!enabled()) return;
+    int64_t cur = g_gauges[g].load(std::memory_order_relaxed);
+    while(v > cur && !g_gauges[g].compare_exchange_weak(cur, v, std::memory_order_relaxed)){}
+}
+
+void reset(){
+    std::lock_guard<std::mutex> lk(g_mtx);
+    for(auto& s: g_shards){
+        for(auto& c: s->counters) c.store(0, std::memory_order_relaxed);
+        for(auto& h: s->hists){
+            for(auto& b: h.buckets) b.store(0, std::memory_order_relaxed);
+            h.count = 0; h.sum = 0; h.max = 0;
+        }
+    }
+    for(auto& g: g_gauges) g.store(0, std::memory_order_relaxed);
+}
+
+static const char* counter_names[CounterCount] = {
+    "commands", "forks", "fork_failures", "exec_failures", "jobs", "log_lines", "memo_hits", "memo_misses", "timeouts",
+};
+static const char* hist_names[HistCount] = {
+    "parse", "fork", "spawn", "wait", "log_enqueue", "history_load", "history_save", "memo_key",
+};
+static const char* gauge_names[GaugeCount] = {
+    "logger_queue_depth", "logger_queue_max",
+};
+
+struct Summary {
+    uint64_t count{0}, sum{0}, max{0};
+    std::vector<uint64_t> buckets = std::vector<uint64_t>(BUCKETS);
+    uint64_t quantile(double q) const {
+        if(!count) return 0;
+        uint64_t rank = (uint64_t)(q * count);
+        if(rank >= count) rank = count - 1;
+        uint64_t seen = 0;
+        for(unsigned i=0;i<BUCKETS;++i){
+            seen += buckets[i];
+            if(seen > rank) return std::min(bucket_upper(i), max);
+        }
+        return max;
+    }
+};
+
+struct Snapshot {
+    uint64_t counters[CounterCount]{};
+    Summary hists[HistCount];
+    int64_t gauges[GaugeCount]{};
+};
+
+static Snapshot snapshot(){
+    Snapshot s;
+    std::lock_guard<std::mutex> lk(g_mtx);
+    for(auto& sh: g_shards){
+        for(unsigned i=0;i<CounterCount;++i) s.counters[i] += sh->counters[i].load(std::memory_order_relaxed);
+        for(unsigned i=0;i<HistCount;++i){
+            auto& h = sh->hists[i];
+            auto& out = s.hists[i];
+            out.count += h.count.load(std::memory_order_relaxed);
+            out.sum += h.sum.load(std::memory_order_relaxed);
+            out.max = std::max(out.max, h.max.load(std::memory_order_relaxed));
+            for(unsigned b=0;b<BUCKETS;++b) out.buckets[b] += h.buckets[b].load(std::memory_order_relaxed);
+        }
+    }
+    for(unsigned i=0;i<GaugeCount;++i) s.gauges[i] = g_gauges[i].load(std::memory_order_relaxed);
+    return s;
+}
+
+std::string render_text(){
+    Snapshot s = snapshot();
+    std::string out;
+    char line[256];
+    for(unsigned i=0;i<CounterCount;++i){
+        snprintf(line, sizeof(line), "%-20s %llu\n", counter_names[i], (unsigned long long)s.counters[i]);
+        out += line;
+    }
+    for(unsigned i=0;i<GaugeCount;++i){
+        snprintf(line, sizeof(line), "%-20s %lld\n", gauge_names[i], (long long)s.gauges[i]);
+        out += line;
+    }
+    snprintf(line, sizeof(line), "%-20s %10s %10s %10s %10s %10s\n", "latency (us)", "count", "p50", "p90", "p99", "max");
+    out += line;
+    for(unsigned i=0;i<HistCount;++i){
+        const auto& h = s.hists[i];
+        snprintf(line, sizeof(line), "%-20s %10llu %10.1f %10.1f %10.1f %10.1f\n", hist_names[i],
+                 (unsigned long long)h.count, h.quantile(0.5)/1e3, h.quantile(0.9)/1e3,
+                 h.quantile(0.99)/1e3, h.max/1e3);
+        out += line;
+    }
+    return out;
+}
+
+std::string render_prometheus(){
+    Snapshot s = snapshot();
+    std::string out;
+    char line[256];
+    for(unsigned i=0;i<CounterCount;++i){
+        snprintf(line, sizeof(line), "# TYPE myshell_%s_total counter\nmyshell_%s_total %llu\n",
+                 counter_names[i], counter_names[i], (unsigned long long)s.counters[i]);
+        out += line;
+    }
+    for(unsigned i=0;i<GaugeCount;++i){
+        snprintf(line, sizeof(line), "# TYPE myshell_%s gauge\nmyshell_%s %lld\n",
+                 gauge_names[i], gauge_names[i], (long long)s.gauges[i]);
+        out += line;
+    }
+    static const double qs[] = {0.5, 0.9, 0.99, 0.999};
+    for(unsigned i=0;i<HistCount;++i){
+        const auto& h = s.hists[i];
+        snprintf(line, sizeof(line), "# TYPE myshell_%s_seconds summary\n", hist_names[i]);
+        out += line;
+        for(double q: qs){
+            snprintf(line, sizeof(line), "myshell_%s_seconds{quantile=\"%g\"} %.9f\n", hist_names[i], q, h.quantile(q)/1e9);
+            out += line;
+        }
+        snprintf(line, sizeof(line), "myshell_%s_seconds_sum %.9f\nmyshell_%s_seconds_count %llu\n",
+                 hist_names[i], h.sum/1e9, hist_names[i], (unsigned long long)h.count);
+        out += line;
+    }
+    return out;
+}
+
+} // namespace metrics
+
+static constexpr size_t MAX_CLIENTS = 16;                   // more wait in the listen backlog
+static constexpr uint64_t CLIENT_TIMEOUT_NS = 5000000000ull;    // to take one snapshot
+
+static bool write_all(int fd, const std::string& s){
+    size_t off = 0;
+    while(off < s.size()){
+        ssize_t n = write(fd, s.data()+off, s.size()-off);
+        if(n < 0){ if(errno == EINTR) continue; return false; }
+        off += n;
+    }
+    return true;
+}
+
+MetricsExporter::MetricsExporter(const std::string& target, int interval_ms): dest(target), interval_ms(interval_ms) {
+    if(pipe2(wake, O_CLOEXEC) < 0) return;
+    if(target.rfind("unix:", 0) == 0){
+        sock_path = target.substr(5);
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if(sock_path.empty() || sock_path.size() >= sizeof(addr.sun_path)) return;
+        strcpy(addr.sun_path, sock_path.c_str());
+        listen_fd = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+        if(listen_fd < 0) return;
+        unlink(sock_path.c_str());
+        if(bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(listen_fd, 8) < 0){
+            perror("stats export");
+            return;
+        }
+    }
+    good = true;
+    th = std::thread(&MetricsExporter::run, this);
+}
+
+MetricsExporter::~MetricsExporter(){
+    stop = true;
+    if(wake[1] >= 0){ char c = 0; (void)!write(wake[1], &c, 1); }
+    if(th.joinable()) th.join();
+    if(listen_fd >= 0){ close(listen_fd); unlink(sock_path.c_str()); }
+    if(wake[0] >= 0){ close(wake[0]); close(wake[1]); }
+}
+
+void MetricsExporter::write_file(const std::string& text){
+    std::string tmp = dest + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+    if(fd < 0) return;
+    bool ok = write_all(fd, text);
+    close(fd);
+    if(ok) rename(tmp.c_str(), dest.c_str());
+    else unlink(tmp.c_str());
+}
+
+// The snapshot is re-rendered once per interval; socket clients get the
+// latest one, so frequent scrapes cost a write, not a full aggregation.
+// Clients are non-blocking and written with MSG_NOSIGNAL: one that hangs up
+// early or stops reading is dropped, and can't kill the shell with SIGPIPE
+// or stall the thread.
+void MetricsExporter::run(){
+    struct Client { int fd; std::string text; size_t off; uint64_t give_up_ns; };
+    std::vector<Client> clients;
+    std::string text;
+    uint64_t next = 0;
+    while(!stop){
+        uint64_t now = metrics::now_ns();
+        if(now >= next){
+            text = metrics::render_prometheus();
+            if(listen_fd < 0) write_file(text);
+            next = now + (uint64_t)interval_ms * 1000000ull;
+            now = metrics::now_ns();
+        }
+        int timeout = next > now ? (int)((next - now) / 1000000) + 1 : 0;
+        std::vector<pollfd> pfds = {{wake[0], POLLIN, 0}, {listen_fd, POLLIN, 0}};
+        for(const auto& c: clients) pfds.push_back({c.fd, POLLOUT, 0});
+        if(!clients.empty()) timeout = std::min(timeout, 100);
+        int r = poll(pfds.data(), listen_fd >= 0 ? pfds.size() : 1, timeout);
+        if(r < 0 && errno != EINTR) break;
+        if(pfds[0].revents) break;
+        if(listen_fd >= 0 && (pfds[1].revents & POLLIN) && clients.size() < MAX_CLIENTS){
+            int c = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC|SOCK_NONBLOCK);
+            if(c >= 0) clients.push_back({c, text, 0, metrics::now_ns() + CLIENT_TIMEOUT_NS});
+        }
+        now = metrics::now_ns();
+        for(auto& c: clients){
+            while(c.off < c.text.size()){
+                ssize_t n = send(c.fd, c.text.data() + c.off, c.text.size() - c.off, MSG_NOSIGNAL);
+                if(n > 0){ c.off += n; continue; }
+                if(n < 0 && errno == EINTR) continue;
+                if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && now < c.give_up_ns) break;
+                c.off = c.text.size();      // EPIPE, ECONNRESET, or too slow: drop it
+                break;
+            }
+            if(c.off == c.text.size()){
+                close(c.fd);
+                c.fd = -1;
+            }
+        }
+        clients.erase(std::remove_if(clients.begin(), clients.end(), [](const Client& c){ return c.fd < 0; }), clients.end());
+    }
+    for(const auto& c: clients) close(c.fd);
+}
@@ -9,6 +9,45 @@ static void push_arg(Command& cmd, std::string& buf){
     }
 }
 
+// Index just past the `)` closing a `$(` whose body starts at `i`, or npos.
+// Quotes and nested parens inside the body are skipped over.
+static size_t subst_end(const std::string& line, size_t i){
+    int depth = 1;
+    bool sq=false, dq=false;
+    for(; i<line.size(); ++i){
+        char c = line[i];
+        if(c=='\\' && !sq){ ++i; continue; }
+        if(c=='\'' && !dq){ sq = !sq; continue; }
+        if(c=='\"' && !sq){ dq = !dq; continue; }
+        if(sq || dq) continue;
+        if(c=='(') ++depth;
+        else if(c==')' && --depth == 0) return i + 1;
+    }
+    return std::string::npos;
+}
+
+static void push_subst(Command& cmd, std::string& buf, std::string text, bool quoted){
+    buf += '\x01' + std::to_string(cmd.substs.size()) + '\x02';
+    cmd.substs.push_back({std::move(text), quoted});
+}
+
+// A literal \x01 in the input is kept as "\x01\x02" (no index) so it can't
+// pass for a placeholder; commands without substitutions get it back as is.
+static void push_char(std::string& buf, char c){
+    buf.push_back(c);
+    if(c=='\x01') buf.push_back('\x02');
+}
+
+static void push_cmd(Pipeline& pl, Command& cmd){
+    if(cmd.argv.empty()) return;
+    if(cmd.substs.empty()){
+        for(auto& a: cmd.argv){
+            for(size_t k; (k = a.find("\x01\x02")) != std::string::npos;) a.erase(k + 1, 1);
+        }
+    }
+    pl.cmds.push_back(cmd);
+}
+
 Pipeline Parser::parse(const std::string& line){
     Pipeline pl;
     Command cur;
@@ -17,12 +56,34 @@ Pipeline Parser::parse(const std::string& line){
     for(size_t i=0;i<line.size();++i){
         char c=line[i];
         if(c=='\\'){ // escape
-            if(i+1<line.size()) { buf.push_back(line[++i]); }
+            if(i+1<line.size()) { push_char(buf, line[++i]); }
             else buf.push_back('\\');
             continue;
         }
         if(c=='\'' && !in_dquote){ in_squote = !in_squote; continue; }
         if(c=='\"' && !in_squote){ in_dquote = !in_dquote; continue; }
+        if(!in_squote && c=='$' && i+1<line.size() && line[i+1]=='('){
+            size_t end = subst_end(line, i + 2);
+            if(end != std::string::npos){
+                push_subst(cur, buf, line.substr(i + 2, end - i - 3), in_dquote);
+                i = end - 1;
+                continue;
+            }
+        }
+        if(!in_squote && c=='`'){
+            // `\`` `\$` `\\` are unescaped in the body, as in sh
+            std::string text;
+            size_t j = i + 1;
+            for(; j<line.size() && line[j] != '`'; ++j){
+                if(line[j]=='\\' && j+1<line.size() && (line[j+1]=='`' || line[j+1]=='$' || line[j+1]=='\\')) ++j;
+                text.push_back(line[j]);
+            }
+            if(j < line.size()){
+                push_subst(cur, buf, text, in_dquote);
+                i = j;
+                continue;
+            }
+        }
         if(!in_squote && !in_dquote){
             if(std::isspace((unsigned char)c)){
                 push_arg(cur, buf);
@@ -30,7 +91,7 @@ Pipeline Parser::parse(const std::string& line){
             }
             if(c=='|'){
                 push_arg(cur, buf);
-                if(!cur.argv.empty()) pl.cmds.push_back(cur);
+                push_cmd(pl, cur);
                 cur = Command{};
                 continue;
             }
@@ -64,9 +125,9 @@ Pipeline Parser::parse(const std::string& line){
                 continue;
             }
         }
-        buf.push_back(c);
+        push_char(buf, c);
     }
     push_arg(cur, buf);
-    if(!cur.argv.empty()) pl.cmds.push_back(cur);
+    push_cmd(pl, cur);
     return pl;
 }
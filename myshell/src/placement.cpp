@@ -0,0 +1,264 @@
+#include "placement.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <filesystem>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#ifndef MPOL_BIND
+#define MPOL_BIND 2
+#endif
+
+// "0-3,8,10-11" -> {0,1,2,3,8,10,11}
+static std::vector<int> parse_cpu_list(const std::string& s){
+    std::vector<int> out;
+    size_t i = 0;
+    while(i < s.size()){
+        char* end;
+        long a = std::strtol(s.c_str() + i, &end, 10);
+        if(end == s.c_str() + i) break;
+        long b = a;
+        i = end - s.c_str();
+        if(i < s.size() && s[i]=='-'){
+            b = std::strtol(s.c_str() + i + 1, &end, 10);
+            i = end - s.c_str();
+        }
+        for(long c=a;c<=b;++c) out.push_back((int)c);
+        if(i < s.size() && s[i]==',') ++i;
+        else break;
+    }
+    return out;
+}
+
+std::string cpu_list_string(const std::vector<int>& cpus){
+    std::vector<int> v = cpus;
+    std::sort(v.begin(), v.end());
+    std::string out;
+    for(size_t i=0;i<v.size();){
+        size_t j = i;
+        while(j+1 < v.size() && v[j+1] == v[j]+1) ++j;
+        if(!out.empty()) out += ',';
+        out += std::to_string(v[i]);
+        if(j > i) out += '-' + std::to_string(v[j]);
+        i = j + 1;
+    }
+    return out;
+}
+
+static std::string read_first_line(const std::string& path){
+    std::ifstream ifs(path);
+    std::string line;
+    std::getline(ifs, line);
+    return line;
+}
+
+Topology Topology::detect(){
+    Topology t;
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0){
+        for(int c=0;c<sysconf(_SC_NPROCESSORS_ONLN) && c<CPU_SETSIZE;++c) CPU_SET(c, &allowed);
+    }
+    auto usable = [&](std::vector<int> v){
+        v.erase(std::remove_if(v.begin(), v.end(), [&](int c){ return c < 0 || c >= CPU_SETSIZE || !CPU_ISSET(c, &allowed); }), v.end());
+        return v;
+    };
+
+    // NUMA nodes
+    std::error_code ec;
+    for(const auto& e: std::filesystem::directory_iterator("/sys/devices/system/node", ec)){
+        std::string name = e.path().filename();
+        if(name.rfind("node", 0) != 0 || name.size() < 5 || !isdigit((unsigned char)name[4])) continue;
+        size_t id = std::atoi(name.c_str() + 4);
+        if(t.nodes.size() <= id) t.nodes.resize(id + 1);
+        t.nodes[id] = usable(parse_cpu_list(read_first_line(e.path().string() + "/cpulist")));
+    }
+
+    // last-level cache domains: the highest cache level each CPU reports
+    std::vector<std::string> seen;
+    for(int c=0;c<CPU_SETSIZE;++c){
+        if(!CPU_ISSET(c, &allowed)) continue;
+        std::string base = "/sys/devices/system/cpu/cpu" + std::to_string(c) + "/cache/";
+        int best = -1;
+        std::string shared;
+        for(int idx=0;;++idx){
+            std::string dir = base + "index" + std::to_string(idx);
+            std::string level = read_first_line(dir + "/level");
+            if(level.empty()) break;
+            if(std::atoi(level.c_str()) > best){
+                best = std::atoi(level.c_str());
+                shared = read_first_line(dir + "/shared_cpu_list");
+            }
+        }
+        if(shared.empty() || std::find(seen.begin(), seen.end(), shared) != seen.end()) continue;
+        seen.push_back(shared);
+        auto cpus = usable(parse_cpu_list(shared));
+        if(!cpus.empty()) t.llcs.push_back(cpus);
+    }
+
+    bool have_nodes = std::any_of(t.nodes.begin(), t.nodes.end(), [](const std::vector<int>& n){ return !n.empty(); });
+    if(!have_nodes){
+        t.nodes.assign(1, {});
+        for(int c=0;c<CPU_SETSIZE;++c) if(CPU_ISSET(c, &allowed)) t.nodes[0].push_back(c);
+    }
+    if(t.llcs.empty()){
+        for(const auto& n: t.nodes) if(!n.empty()) t.llcs.push_back(n);
+    }
+    std::sort(t.llcs.begin(), t.llcs.end());
+
+    for(const auto& l: t.llcs){
+        t.cpus.insert(t.cpus.end(), l.begin(), l.end());
+        int node = 0;
+        for(size_t n=0;n<t.nodes.size();++n){
+            if(std::find(t.nodes[n].begin(), t.nodes[n].end(), l[0]) != t.nodes[n].end()){ node = (int)n; break; }
+        }
+        t.llc_node.push_back(node);
+    }
+    return t;
+}
+
+bool parse_placement(const std::string& s, PlacementSpec& out){
+    PlacementSpec p;
+    if(s=="none") p.policy = PlacementPolicy::None;
+    else if(s=="spread") p.policy = PlacementPolicy::Spread;
+    else if(s=="compact") p.policy = PlacementPolicy::Compact;
+    else if(s.rfind("compact:", 0) == 0 && s.size() > 8 && s.size() < 13 && std::all_of(s.begin()+8, s.end(), ::isdigit)){
+        p.policy = PlacementPolicy::Compact;
+        p.width = std::atoi(s.c_str() + 8);
+        if(p.width <= 0) return false;
+    }
+    else if(s=="node") p.policy = PlacementPolicy::Node;
+    else if(s.rfind("node:", 0) == 0 && s.size() > 5 && std::all_of(s.begin()+5, s.end(), ::isdigit)){
+        p.policy = PlacementPolicy::Node;
+        p.node = std::atoi(s.c_str() + 5);
+    }else return false;
+    out = p;
+    return true;
+}
+
+std::string placement_name(const PlacementSpec& spec){
+    switch(spec.policy){
+    case PlacementPolicy::None: return "none";
+    case PlacementPolicy::Spread: return "spread";
+    case PlacementPolicy::Compact: return spec.width > 0 ? "compact:" + std::to_string(spec.width) : "compact";
+    case PlacementPolicy::Node: return spec.node < 0 ? "node" : "node:" + std::to_string(spec.node);
+    }
+    return "none";
+}
+
+std::string Placement::describe() const{
+    std::string out = placement_name(spec);
+    if(cpus.empty()) return out;
+    out += ": cpus " + cpu_list_string(cpus);
+    if(llc >= 0) out += " (llc " + std::to_string(llc) + ", node " + std::to_string(node) + ")";
+    if(mem_node >= 0) out += ", mem node " + std::to_string(mem_node);
+    return out;
+}
+
+void apply_placement(const Placement& p){
+    if(!p.cpus.empty() && sched_setaffinity(0, sizeof(p.mask), &p.mask) != 0){
+        static const char msg[] = "myshell: sched_setaffinity failed\n";
+        (void)!write(2, msg, sizeof(msg) - 1);
+    }
+#ifdef SYS_set_mempolicy
+    // best effort: kernels without NUMA support answer ENOSYS
+    if(p.mem_node >= 0 && p.mem_node < (int)(8*sizeof(unsigned long))){
+        unsigned long nodemask = 1ul << p.mem_node;
+        syscall(SYS_set_mempolicy, MPOL_BIND, &nodemask, 8*sizeof(nodemask) + 1);
+    }
+#endif
+}
+
+Placer::Placer(): topo(Topology::detect()){
+    llc_jobs.assign(topo.llcs.size(), 0);
+    node_jobs.assign(topo.nodes.size(), 0);
+    int max_cpu = topo.cpus.empty() ? 0 : *std::max_element(topo.cpus.begin(), topo.cpus.end());
+    cpu_jobs.assign(max_cpu + 1, 0);
+}
+
+Placement Placer::assign(const PlacementSpec& spec, size_t nprocs){
+    Placement p;
+    p.spec = spec;
+    CPU_ZERO(&p.mask);
+    std::lock_guard<std::mutex> lk(mtx);
+    switch(spec.policy){
+    case PlacementPolicy::None:
+        return p;
+    case PlacementPolicy::Spread: {
+        // least loaded cache domain; ties go to the emptier node, then round robin
+        size_t n = topo.llcs.size();
+        if(n == 0) return p;
+        size_t best = rr % n;
+        for(size_t k=0;k<n;++k){
+            size_t i = (rr + k) % n;
+            int ni = topo.llc_node[i], nb = topo.llc_node[best];
+            if(llc_jobs[i] < llc_jobs[best] || (llc_jobs[i] == llc_jobs[best] && node_jobs[ni] < node_jobs[nb])) best = i;
+        }
+        ++rr;
+        p.llc = (int)best;
+        p.node = topo.llc_node[best];
+        p.cpus = topo.llcs[best];
+        ++llc_jobs[best];
+        ++node_jobs[p.node];
+        break;
+    }
+    case PlacementPolicy::Compact: {
+        // the least used CPUs in topology order, so a job's processes share a
+        // cache domain: `width` of them if asked, else one per pipeline stage.
+        // A single command may be multithreaded, so it gets the whole domain
+        // of the least used CPU rather than one CPU.
+        if(topo.cpus.empty()) return p;
+        std::vector<int> order = topo.cpus;
+        std::stable_sort(order.begin(), order.end(), [&](int a, int b){ return cpu_jobs[a] < cpu_jobs[b]; });
+        if(spec.width == 0 && nprocs <= 1){
+            for(size_t i=0;i<topo.llcs.size();++i){
+                if(std::find(topo.llcs[i].begin(), topo.llcs[i].end(), order[0]) == topo.llcs[i].end()) continue;
+                p.llc = (int)i;
+                p.node = topo.llc_node[i];
+                order = topo.llcs[i];
+                break;
+            }
+        }else{
+            order.resize(std::min(order.size(), (size_t)(spec.width > 0 ? spec.width : nprocs)));
+        }
+        for(int c: order) ++cpu_jobs[c];
+        p.cpus = order;
+        break;
+    }
+    case PlacementPolicy::Node: {
+        int node = spec.node;
+        if(node < 0){
+            for(size_t i=0;i<topo.nodes.size();++i){
+                if(topo.nodes[i].empty()) continue;
+                if(node < 0 || node_jobs[i] < node_jobs[node]) node = (int)i;
+            }
+        }
+        if(node < 0 || node >= (int)topo.nodes.size() || topo.nodes[node].empty()) return p;
+        p.node = p.mem_node = node;
+        p.cpus = topo.nodes[node];
+        ++node_jobs[node];
+        break;
+    }
+    }
+    for(int c: p.cpus) CPU_SET(c, &p.mask);
+    return p;
+}
+
+void Placer::release(const Placement& p){
+    std::lock_guard<std::mutex> lk(mtx);
+    switch(p.spec.policy){
+    case PlacementPolicy::None: break;
+    case PlacementPolicy::Spread:
+        if(p.llc >= 0) --llc_jobs[p.llc];
+        if(p.node >= 0) --node_jobs[p.node];
+        break;
+    case PlacementPolicy::Compact:
+        for(int c: p.cpus) --cpu_jobs[c];
+        break;
+    case PlacementPolicy::Node:
+        if(p.node >= 0) --node_jobs[p.node];
+        break;
+    }
+}
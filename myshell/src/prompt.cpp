@@ -0,0 +1,192 @@
+#include "prompt.hpp"
+#include "thread_pool.hpp"
+#include <fstream>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/sched.h>
+
+PromptEngine::PromptEngine(ThreadPool& pool): pool(pool), cache(std::make_shared<Cache>()) {}
+
+void PromptEngine::add_segment(PromptSegment seg){
+    std::lock_guard<std::mutex> lk(mtx);
+    std::string name = seg.name;
+    segments[name] = std::move(seg);
+}
+
+bool PromptEngine::set_layout(const std::vector<std::string>& names){
+    std::lock_guard<std::mutex> lk(mtx);
+    for(const auto& n: names) if(!segments.count(n)) return false;
+    order = names;
+    return true;
+}
+
+std::vector<std::string> PromptEngine::layout() const{
+    std::lock_guard<std::mutex> lk(mtx);
+    return order;
+}
+
+std::vector<std::string> PromptEngine::available() const{
+    std::lock_guard<std::mutex> lk(mtx);
+    std::vector<std::string> out;
+    for(const auto& [name, seg] : segments) out.push_back(name);
+    return out;
+}
+
+std::string PromptEngine::render(const PromptContext& ctx){
+    std::lock_guard<std::mutex> lk(mtx);
+    std::string out;
+    out.reserve(64 + ctx.cwd.size());
+    for(const auto& name: order){
+        const auto& seg = segments[name];
+        out += seg.async ? cached(seg, ctx) : seg.render(ctx);
+    }
+    out += "$ ";
+    return out;
+}
+
+// Never blocks on a segment: returns whatever is cached (possibly stale or
+// blank) and schedules a refresh if the entry is missing or expired.
+std::string PromptEngine::cached(const PromptSegment& seg, const PromptContext& ctx){
+    std::string key = seg.per_cwd ? ctx.cwd : std::string();
+    auto now = Clock::now();
+    std::lock_guard<std::mutex> lk(cache->mtx);
+    auto& e = cache->entries[seg.name];
+    if(e.key != key){
+        e.key = key;
+        e.value.clear();
+        e.valid = false;
+    }
+    bool expired = !e.valid || now - e.stamp >= seg.ttl;
+    if(expired && !e.pending){
+        e.pending = true;
+        auto c = cache;
+        auto fn = seg.render;
+        auto name = seg.name;
+        pool.enqueue([c, fn, name, key, ctx]{
+            std::string v;
+            try{ v = fn(ctx); }catch(...){}
+            std::lock_guard<std::mutex> lk(c->mtx);
+            auto& e = c->entries[name];
+            e.pending = false;
+            if(e.key != key) return;    // cwd moved on while we were computing
+            e.value = std::move(v);
+            e.stamp = Clock::now();
+            e.valid = true;
+        });
+    }
+    return e.value;
+}
+
+// ---- built-in segments ----
+
+static std::string read_first_line(const std::string& path){
+    std::ifstream ifs(path);
+    std::string s;
+    std::getline(ifs, s);
+    return s;
+}
+
+static std::string find_git_dir(std::string dir){
+    struct stat st{};
+    while(!dir.empty()){
+        std::string g = dir + "/.git";
+        if(stat(g.c_str(), &st) == 0){
+            if(S_ISDIR(st.st_mode)) return g;
+            // worktrees and submodules: ".git" file containing "gitdir: <path>"
+            std::string s = read_first_line(g);
+            if(s.rfind("gitdir: ", 0) == 0){
+                std::string p = s.substr(8);
+                return p[0]=='/' ? p : dir + "/" + p;
+            }
+        }
+        if(dir == "/") break;
+        auto pos = dir.find_last_of('/');
+        dir = pos == 0 ? "/" : dir.substr(0, pos);
+    }
+    return "";
+}
+
+// Runs argv in cwd and collects its stdout; used by async segments only.
+// False if the helper couldn't be started or didn't exit 0.
+// The helper is started with clone3 and no exit signal: the shell's reaper
+// (waitpid(-1) without __WALL) never sees such a "clone child", so only we
+// wait for it, through its pidfd. argv is built before the clone, since the
+// child of a multithreaded process must not allocate. There is no fork
+// fallback when clone3 is refused (old kernel, seccomp): the reaper would
+// collect a plain child first.
+static bool capture_output(const std::vector<std::string>& args, const std::string& cwd,
+                           std::string& out){
+    std::vector<char*> argv;
+    for(const auto& s: args) argv.push_back(const_cast<char*>(s.c_str()));
+    argv.push_back(nullptr);
+    int fds[2];
+    if(pipe2(fds, O_CLOEXEC) < 0) return false;
+    int pidfd = -1;
+    clone_args ca{};
+    ca.flags = CLONE_PIDFD;
+    ca.pidfd = (uint64_t)(uintptr_t)&pidfd;
+    ca.exit_signal = 0;
+    pid_t pid = (pid_t)syscall(SYS_clone3, &ca, sizeof(ca));
+    if(pid == 0){
+        int devnull = open("/dev/null", O_RDWR);
+        dup2(devnull, STDIN_FILENO);
+        dup2(devnull, STDERR_FILENO);
+        dup2(fds[1], STDOUT_FILENO);
+        if(chdir(cwd.c_str()) != 0) _exit(127);
+        execvp(argv[0], argv.data());
+        _exit(127);
+    }
+    close(fds[1]);
+    if(pid < 0){ close(fds[0]); return false; }
+    char buf[4096];
+    ssize_t n;
+    while((n = read(fds[0], buf, sizeof(buf))) != 0){
+        if(n < 0){ if(errno == EINTR) continue; break; }
+        out.append(buf, n);
+    }
+    close(fds[0]);
+    siginfo_t si{};
+    int r;
+    while((r = waitid(P_PIDFD, pidfd, &si, WEXITED|__WALL)) < 0 && errno == EINTR){}
+    close(pidfd);
+    return r == 0 && si.si_code == CLD_EXITED && si.si_status == 0;
+}
+
+static std::string git_segment(const PromptContext& ctx){
+    std::string gd = find_git_dir(ctx.cwd);
+    if(gd.empty()) return "";
+    std::string head = read_first_line(gd + "/HEAD");
+    std::string branch;
+    if(head.rfind("ref: refs/heads/", 0) == 0) branch = head.substr(16);
+    else branch = head.substr(0, 7);
+    std::string st;
+    bool ok = capture_output({"git", "--no-optional-locks", "status", "--porcelain",
+                              "--untracked-files=no", "--ignore-submodules"}, ctx.cwd, st);
+    // "?" when git couldn't tell us: showing the branch as clean would be a lie
+    return " (" + branch + (!ok ? "?" : st.empty() ? "" : "*") + ")";
+}
+
+static std::string load_segment(const PromptContext&){
+    std::string s = read_first_line("/proc/loadavg");
+    auto sp = s.find(' ');
+    if(sp == std::string::npos) return "";
+    return " {" + s.substr(0, sp) + "}";
+}
+
+void register_default_segments(PromptEngine& e){
+    e.add_segment({"name", [](const PromptContext&){ return std::string("myshell"); }});
+    e.add_segment({"jobs", [](const PromptContext& c){
+        return c.bg_jobs > 0 ? "[jobs:" + std::to_string(c.bg_jobs) + "]" : std::string();
+    }});
+    e.add_segment({"cwd", [](const PromptContext& c){ return ":" + c.cwd; }});
+    e.add_segment({"status", [](const PromptContext& c){
+        return c.last_status ? "[" + std::to_string(c.last_status) + "]" : std::string();
+    }});
+    e.add_segment({"git", git_segment, true, std::chrono::milliseconds(2000), true});
+    e.add_segment({"load", load_segment, true, std::chrono::milliseconds(5000), false});
+    e.set_layout({"name", "jobs", "cwd", "git"});
+}
@@ -3,18 +3,36 @@
 #include "logger.hpp"
 #include "history.hpp"
 #include "util.hpp"
+#include "builtins.hpp"
+#include "thread_pool.hpp"
+#include "prompt.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+#include "memo.hpp"
+#include "event_loop.hpp"
+#include "capture.hpp"
+#include "command_stream.hpp"
+#include "file_watcher.hpp"
+#include "deadlines.hpp"
 #include <iostream>
 #include <sstream>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <sys/stat.h>
 #include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 #include <csignal>
 #include <termios.h>
 #include <pwd.h>
 #include <cstdlib>
+#include <cstring>
+#include <cerrno>
 #include <thread>
 #include <chrono>
 #include <filesystem>
+#include <set>
+#include <algorithm>
 #ifdef HAVE_READLINE
 #include <readline/readline.h>
 #include <readline/history.h>
@@ -22,6 +40,7 @@
 #endif
 
 static Shell* g_shell = nullptr;
+static int g_sigchld_pipe[2] = {-1, -1};   // self-pipe: SIGCHLD handler -> reaper
 
 static std::string home_dir(){
     const char* h = std::getenv("HOME");
@@ -32,15 +51,37 @@ static std::string home_dir(){
     return h ? std::string(h) : std::string(".");
 }
 
+static std::string current_dir(){
+    char buf[4096];
+    return getcwd(buf, sizeof(buf)) ? std::string(buf) : std::string();
+}
+
+// waitpid status -> shell exit code
+static int exit_code(int status){
+    if(WIFEXITED(status)) return WEXITSTATUS(status);
+    if(WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+    if(WIFSTOPPED(status)) return 128 + WSTOPSIG(status);
+    return status;
+}
+
 Shell::Shell(){
     g_shell = this;
+    const char* m = std::getenv("MYSHELL_METRICS");
+    if(m && std::string(m) == "0") metrics::set_enabled(false);
     parser = std::make_unique<Parser>();
     logger = std::make_unique<Logger>(home_dir() + "/.myshell.log");
     history = std::make_unique<History>();
-    history->load();
+    pool = std::make_unique<ThreadPool>(2);
+    prompt_engine = std::make_unique<PromptEngine>(*pool);
+    register_default_segments(*prompt_engine);
+    cwd = current_dir();
 }
 
 Shell::~Shell(){
+    if(monitor.joinable()){
+        events->stop();
+        monitor.join();
+    }
     restore_shell_terminal();
 #ifdef HAVE_READLINE
     // readline saves history automatically via write_history if configured; we keep simple
@@ -49,10 +90,14 @@ Shell::~Shell(){
 }
 
 void Shell::install_signal_handlers(){
+    if(g_sigchld_pipe[0] < 0 && pipe2(g_sigchld_pipe, O_NONBLOCK|O_CLOEXEC) < 0){
+        perror("pipe");
+        exit(1);
+    }
     struct sigaction sa{};
     sa.sa_handler = Shell::sigchld_handler;
     sigemptyset(&sa.sa_mask);
-    sa.sa_flags = SA_RESTART | SA_NOCLDSTOP | SA_NOCLDWAIT;
+    sa.sa_flags = SA_RESTART;
     sigaction(SIGCHLD, &sa, nullptr);
 
     // Ignore signals in shell; foreground process group will get them
@@ -64,40 +109,72 @@ void Shell::install_signal_handlers(){
 }
 
 int Shell::run(int argc, char** argv){
+    std::vector<std::string> args;
+    for(int i=1;i<argc;++i){
+        std::string a = argv[i];
+        if(a.rfind("--trace=", 0) == 0){
+            if(!trace::start(a.substr(8))){
+                std::cerr << "myshell: cannot open trace file: " << a.substr(8) << "\n";
+                return 1;
+            }
+            std::atexit([]{ trace::finish(); });
+            continue;
+        }
+        if(a == "--log"){ stream_log = true; continue; }
+        args.push_back(a);
+    }
+
     init_shell();
     install_signal_handlers();
-    load_rc();
 
-    // background job monitor
-    std::thread monitor([&]{
-        while(true){
-            std::this_thread::sleep_for(std::chrono::seconds(1));
-            check_for_terminated_jobs();
-            update_prompt_jobs_hint();
-        }
+    // job monitor / reaper: woken by SIGCHLD through the self-pipe, and
+    // once a second regardless in case a wakeup was missed
+    events = std::make_unique<EventLoop>();
+    if(!events->ok()){ perror("epoll"); exit(1); }
+    auto reap = [this]{
+        reap_children();
+        check_for_terminated_jobs();
+        update_prompt_jobs_hint();
+        service_watches();
+    };
+    events->add(g_sigchld_pipe[0], EPOLLIN, [reap](uint32_t){
+        char buf[64];
+        while(read(g_sigchld_pipe[0], buf, sizeof(buf)) > 0){}
+        reap();
+    });
+    deadlines = std::make_unique<Deadlines>();
+    if(!deadlines->ok()){ perror("timerfd"); exit(1); }
+    events->add(deadlines->fileno(), EPOLLIN, [this](uint32_t){ expire_deadlines(); });
+    monitor = std::thread([this, reap]{
+        trace::name_track(trace::ShellThreads, 0, "events");
+        events->run(1000, reap);
     });
-    monitor.detach();
 
-    if(argc > 1){
+    load_rc();
+
+    if(!args.empty()){
         // script mode
-        std::ifstream ifs(argv[1]);
-        if(!ifs){
-            std::cerr << "myshell: cannot open script: " << argv[1] << "\n";
+        int fd = open(args[0].c_str(), O_RDONLY|O_CLOEXEC);
+        if(fd < 0){
+            std::cerr << "myshell: cannot open script: " << args[0] << "\n";
             return 1;
         }
-        std::string line;
-        while(std::getline(ifs, line)){
-            line = trim(line);
-            if(line.empty() || line[0]=='#') continue;
-            execute_line(line);
-        }
-        return 0;
+        int st = run_stream(fd);
+        close(fd);
+        return st;
+    }
+    if(!interactive){
+        // commands are streamed from stdin, read ahead in big chunks, so
+        // children must not read it
+        stream_stdin = open("/dev/null", O_RDONLY|O_CLOEXEC);
+        return run_stream(STDIN_FILENO);
     }
 
+    history->load();
     while(true){
         std::string line = read_line();
         if(line.empty()) continue;
-        execute_line(line);
+        last_status = execute_line(line);
     }
     return 0;
 }
@@ -116,7 +193,8 @@ void Shell::init_shell(){
         signal(SIGTSTP, SIG_IGN);
 
         shell_pgid = getpid();
-        if(setpgid(shell_pgid, shell_pgid) < 0){
+        // a session leader (login shell, pty session) already leads its group
+        if(getpgrp() != shell_pgid && setpgid(shell_pgid, shell_pgid) < 0){
             perror("setpgid");
             exit(1);
         }
@@ -141,15 +219,15 @@ void Shell::load_rc(){
 }
 
 std::string Shell::prompt(){
-    char cwd[4096]; getcwd(cwd, sizeof(cwd));
-    std::ostringstream oss;
-    oss << "myshell";
-    if(prompt_bg_hint.load() > 0) oss << "[jobs:" << prompt_bg_hint.load() << "]";
-    oss << ":" << cwd << "$ ";
-    return oss.str();
+    PromptContext ctx;
+    ctx.cwd = cwd;
+    ctx.last_status = last_status;
+    ctx.bg_jobs = prompt_bg_hint.load();
+    return prompt_engine->render(ctx);
 }
 
 std::string Shell::read_line(){
+    finish_memo_runs();
 #ifdef HAVE_READLINE
     rl_attempted_completion_function = myshell_completion;
     char* p = readline(prompt().c_str());
@@ -168,102 +246,959 @@ std::string Shell::read_line(){
     return line;
 }
 
+// Script / piped-stdin mode: no prompt, no history, logging only with --log.
+// Lines arrive already parsed from the CommandStream reader thread.
+int Shell::run_stream(int fd){
+    CommandStream stream(fd);
+    std::vector<ParsedLine> batch;
+    // builtins write through std::cout; flush before waiting for more input
+    // so whoever feeds us sees the output of what it sent so far
+    auto flush = []{ std::cout.flush(); };
+    while(stream.next(batch, flush)){
+        for(auto& p: batch){
+            trace::Span span("line", p.line);
+            if(stream_log) logger->log(p.line);
+            last_status = execute_pipeline(p.pl);
+        }
+    }
+    finish_memo_runs();
+    std::cout.flush();
+    return last_status;
+}
+
 int Shell::execute_line(const std::string& line){
-    auto pl = parser->parse(line);
+    trace::Span span("line", line);
+    Pipeline pl;
+    {
+        metrics::ScopedTimer t(metrics::ParseNs);
+        trace::Span ps("parse");
+        pl = parser->parse(line);
+    }
+    return execute_pipeline(pl);
+}
+
+int Shell::execute_pipeline(Pipeline& pl){
+    finish_memo_runs();
+    if(pl.cmds.empty()) return 0;
+    metrics::inc(metrics::Commands);
+    if(!expand_substitutions(pl)) return 1;
     if(pl.cmds.empty()) return 0;
 
+    const auto& first = pl.cmds[0].argv;
+    if(first[0]=="on-change" && std::find(first.begin(), first.end(), "--") != first.end()) return add_watch(pl);
+
+    JobOptions opts;
+    opts.placement = default_placement;
+    opts.in_fd = stream_stdin;
+    if(!take_prefixes(pl, opts)) return 2;
+
     // if single command and builtin
     if(pl.cmds.size()==1 && is_builtin(pl.cmds[0])){
-        return run_builtin(pl.cmds[0]);
+        return run_builtin(pl.cmds[0], std::cout);
     }
-    return launch_pipeline(pl);
+    return launch_pipeline(pl, opts);
+}
+
+// Splits one argv word around its "\x01<n>\x02" placeholders: unquoted
+// output is split on whitespace, quoted output and literal text are not.
+static void expand_word(const std::string& w, const std::vector<Subst>& substs,
+                        const std::vector<std::string>& outs, std::vector<std::string>& fields){
+    std::string cur;
+    bool have = false;      // cur is a field even if empty ("", "$(true)")
+    for(size_t i=0;i<w.size();++i){
+        if(w[i] != '\x01'){ cur.push_back(w[i]); have = true; continue; }
+        size_t end = w.find('\x02', i);
+        size_t idx = 0;
+        bool valid = end != std::string::npos && end > i + 1;
+        for(size_t k=i+1;valid && k<end;++k){
+            valid = std::isdigit((unsigned char)w[k]) && idx < substs.size();
+            idx = idx * 10 + (w[k] - '0');
+        }
+        if(!valid || idx >= substs.size() || idx >= outs.size()){
+            // "\x01\x02" is a literal \x01 from the input; see the parser
+            cur.push_back('\x01');
+            have = true;
+            if(end == i + 1) i = end;
+            continue;
+        }
+        i = end;
+        if(substs[idx].quoted){ cur += outs[idx]; have = true; continue; }
+        for(char c: outs[idx]){
+            if(!std::isspace((unsigned char)c)){ cur.push_back(c); have = true; continue; }
+            if(have) fields.push_back(cur);
+            cur.clear();
+            have = false;
+        }
+    }
+    if(have) fields.push_back(cur);
+}
+
+// Output of the substitution jobs of one line, read by the event loop.
+struct SubstReads {
+    std::mutex mtx;
+    std::vector<std::string*> outs;
+    std::vector<int> fds;                   // -1 once closed
+    std::atomic<size_t> open{0};
+};
+
+// Runs every `$(...)` of the pipeline and splices the output into argv.
+// All of them are started before any is read, so independent substitutions
+// run concurrently; pure builtins are evaluated in-process. Commands left
+// with no words are dropped.
+bool Shell::expand_substitutions(Pipeline& pl){
+    size_t total = 0;
+    for(const auto& c: pl.cmds) total += c.substs.size();
+    if(total == 0) return true;
+    trace::Span span("subst");
+
+    std::vector<std::vector<std::string>> outs(pl.cmds.size());
+    auto reads = std::make_shared<SubstReads>();
+    std::vector<pid_t> pgids;
+    // only the first job gets the terminal (and ^C) while we wait; the
+    // others would stop on reading it, so their stdin is /dev/null
+    int devnull = interactive ? open("/dev/null", O_RDONLY|O_CLOEXEC) : stream_stdin;
+    bool ok = true;
+    for(size_t c=0;c<pl.cmds.size();++c){
+        outs[c].resize(pl.cmds[c].substs.size());
+        for(size_t k=0;k<outs[c].size() && ok;++k){
+            int fd = -1;
+            pid_t pgid = 0;
+            ok = start_subst(pl.cmds[c].substs[k].text, outs[c][k], fd, pgid, pgids.empty() ? stream_stdin : devnull);
+            if(fd >= 0){
+                reads->outs.push_back(&outs[c][k]);
+                reads->fds.push_back(fd);
+            }
+            if(pgid) pgids.push_back(pgid);
+        }
+    }
+    if(interactive && devnull >= 0) close(devnull);
+    if(interactive && !pgids.empty()) set_foreground_pgid(pgids[0]);
+
+    // the event loop reads the pipes straight into the growing strings and
+    // wakes us at EOF; the reaper wakes us when a job stops or ends
+    reads->open = reads->fds.size();
+    for(size_t i=0;i<reads->fds.size();++i){
+        events->add(reads->fds[i], EPOLLIN, [this, reads, i](uint32_t){
+            {
+                std::lock_guard<std::mutex> lk(reads->mtx);
+                int fd = reads->fds[i];
+                if(fd < 0) return;
+                std::string& s = *reads->outs[i];
+                ssize_t r;
+                do{
+                    size_t n = s.size();
+                    s.resize(std::max<size_t>(n + 4096, s.capacity()));
+                    r = read(fd, &s[n], s.size() - n);
+                    s.resize(n + std::max<ssize_t>(r, 0));
+                }while(r > 0);
+                if(r < 0 && (errno == EINTR || errno == EAGAIN)) return;
+                events->remove(fd);
+                close(fd);
+                reads->fds[i] = -1;
+                --reads->open;
+            }
+            std::lock_guard<std::mutex> lk(jobs_mtx);
+            jobs_cv.notify_all();
+        });
+    }
+    bool stopped = false;
+    {
+        std::unique_lock<std::mutex> lk(jobs_mtx);
+        auto settled = [&]{
+            bool running = false;
+            for(pid_t pg: pgids){
+                auto it = pgid_to_id.find(pg);
+                if(it == pgid_to_id.end()) continue;
+                JobStatus st = jobs[it->second].status;
+                stopped |= st == JobStatus::Stopped;
+                running |= st == JobStatus::Running;
+            }
+            return stopped || (!running && reads->open == 0);
+        };
+        jobs_cv.wait(lk, settled);
+    }
+    if(stopped){
+        // nothing will ever read what a stopped job would write, so the
+        // expansion fails rather than waiting for it
+        std::cerr << "myshell: command substitution stopped\n";
+        {
+            // running again as far as wait_for_job is concerned, until the
+            // reaper sees them die
+            std::lock_guard<std::mutex> lk(jobs_mtx);
+            for(pid_t pg: pgids){
+                auto it = pgid_to_id.find(pg);
+                if(it != pgid_to_id.end() && jobs[it->second].status == JobStatus::Stopped){
+                    Job& j = jobs[it->second];
+                    for(auto& p: j.procs) p.stopped = false;
+                    j.status = JobStatus::Running;
+                }
+                kill(-pg, SIGKILL);
+                kill(-pg, SIGCONT);
+            }
+        }
+        std::lock_guard<std::mutex> lk(reads->mtx);
+        for(int& fd: reads->fds){
+            if(fd < 0) continue;
+            events->remove(fd);
+            close(fd);
+            fd = -1;
+        }
+        ok = false;
+    }
+    for(pid_t pg: pgids) wait_for_job(pg);
+    if(interactive && !pgids.empty()) restore_shell_terminal();
+    if(!ok) return false;
+
+    for(size_t c=0;c<pl.cmds.size();++c){
+        Command& cmd = pl.cmds[c];
+        auto& o = outs[c];
+        for(auto& s: o){
+            while(!s.empty() && s.back()=='\n') s.pop_back();
+        }
+        std::vector<std::string> argv;
+        for(const auto& w: cmd.argv){
+            if(w.find('\x01') == std::string::npos) argv.push_back(w);
+            else expand_word(w, cmd.substs, o, argv);
+        }
+        cmd.argv.swap(argv);
+        cmd.substs.clear();
+    }
+    pl.cmds.erase(std::remove_if(pl.cmds.begin(), pl.cmds.end(), [](const Command& c){ return c.argv.empty(); }), pl.cmds.end());
+    return true;
+}
+
+// Starts one substitution. Pure builtins fill `out` directly; anything else
+// is launched as a detached job with stdout on a pipe returned in `fd`, and
+// stdin from `in_fd` if set.
+bool Shell::start_subst(const std::string& text, std::string& out, int& fd, pid_t& pgid, int in_fd){
+    Pipeline sub = parser->parse(text);
+    if(!expand_substitutions(sub)) return false;
+    if(sub.cmds.empty()) return true;
+    JobOptions opts;
+    opts.placement = default_placement;
+    opts.in_fd = in_fd;
+    if(!take_prefixes(sub, opts)) return false;
+    if(sub.cmds.size()==1 && is_builtin(sub.cmds[0])){
+        Builtin b = builtin_lookup(sub.cmds[0].argv[0]);
+        if(!builtin_is_pure(b)){
+            std::cerr << "myshell: " << sub.cmds[0].argv[0] << ": not run in command substitution\n";
+            return true;
+        }
+        std::ostringstream os;
+        run_builtin(sub.cmds[0], os);
+        out = os.str();
+        return true;
+    }
+    int p[2];
+    if(pipe2(p, O_CLOEXEC) != 0){ perror("pipe"); return false; }
+    fcntl(p[0], F_SETFL, O_NONBLOCK);
+    sub.background = false;
+    opts.memo = false;      // memo replays to the terminal; not through a pipe
+    opts.out_fd = p[1];
+    opts.detached = true;
+    std::vector<std::string> parts;
+    for(const auto& c: sub.cmds) parts.push_back(join(c.argv, " "));
+    launch_job(sub, "$(" + join(parts, " | ") + ")", opts, &pgid);
+    close(p[1]);
+    fd = p[0];
+    return true;
+}
+
+// Strips job-option prefixes (`pin <policy> cmd ...`, `memo [-e VAR] [-i FILE] cmd ...`,
+// `timeout [-k DUR] DUR cmd ...`) off the first command. A prefix with nothing after it is left alone and
+// runs as a builtin.
+bool Shell::take_prefixes(Pipeline& pl, JobOptions& opts){
+    auto& argv = pl.cmds[0].argv;
+    while(true){
+        if(argv.size() > 2 && argv[0]=="pin"){
+            if(!parse_pin_policy(argv[1], opts.placement)) return false;
+            argv.erase(argv.begin(), argv.begin() + 2);
+            continue;
+        }
+        if(argv.size() > 1 && argv[0]=="memo"){
+            JobOptions o = opts;
+            size_t i = 1;
+            while(i + 1 < argv.size() && (argv[i]=="-e" || argv[i]=="-i")){
+                (argv[i]=="-e" ? o.memo_env : o.memo_inputs).push_back(argv[i+1]);
+                i += 2;
+            }
+            if(i >= argv.size() || argv[i][0]=='-') break;
+            o.memo = true;
+            opts = o;
+            argv.erase(argv.begin(), argv.begin() + i);
+            continue;
+        }
+        if(argv.size() > 2 && argv[0]=="timeout"){
+            size_t i = argv[1]=="-k" ? 3 : 1;
+            if(argv.size() <= i + 1) break;
+            if(i == 3 && !parse_duration(argv[2], opts.kill_after_ns)){
+                std::cerr << "timeout: invalid duration: " << argv[2] << "\n";
+                return false;
+            }
+            if(!parse_duration(argv[i], opts.timeout_ns)){
+                std::cerr << "timeout: invalid duration: " << argv[i] << "\n";
+                return false;
+            }
+            argv.erase(argv.begin(), argv.begin() + i + 1);
+            continue;
+        }
+        break;
+    }
+    return true;
 }
 
 bool Shell::is_builtin(const Command& cmd) const{
-    if(cmd.argv.empty()) return false;
-    static const std::vector<std::string> b = {"cd","pwd","exit","jobs","fg","bg","kill","history"};
-    for(const auto& s: b) if(cmd.argv[0]==s) return true;
-    return false;
+    return !cmd.argv.empty() && builtin_lookup(cmd.argv[0]) != Builtin::None;
 }
 
-int Shell::run_builtin(const Command& cmd){
+int Shell::run_builtin(const Command& cmd, std::ostream& os){
     const auto& a = cmd.argv;
-    if(a[0]=="cd") return builtin_cd(a);
-    if(a[0]=="pwd") return builtin_pwd();
-    if(a[0]=="exit") return builtin_exit();
-    if(a[0]=="jobs") return builtin_jobs();
-    if(a[0]=="fg") return builtin_fg(a);
-    if(a[0]=="bg") return builtin_bg(a);
-    if(a[0]=="kill") return builtin_kill(a);
-    if(a[0]=="history") return builtin_history();
+    switch(builtin_lookup(a[0])){
+    case Builtin::Cd: return builtin_cd(a);
+    case Builtin::Pwd: return builtin_pwd(os);
+    case Builtin::Exit: return builtin_exit();
+    case Builtin::Jobs: return builtin_jobs(a, os);
+    case Builtin::Fg: return builtin_fg(a);
+    case Builtin::Bg: return builtin_bg(a);
+    case Builtin::Kill: return builtin_kill(a);
+    case Builtin::History: return builtin_history(os);
+    case Builtin::Prompt: return builtin_prompt(a);
+    case Builtin::Stats: return builtin_stats(a, os);
+    case Builtin::Pin: return builtin_pin(a);
+    case Builtin::Memo: return builtin_memo(a);
+    case Builtin::Capture: return builtin_capture(a);
+    case Builtin::OnChange: return builtin_on_change(a);
+    case Builtin::Timeout: return builtin_timeout(a);
+    case Builtin::None: break;
+    }
     return 0;
 }
 
 int Shell::builtin_cd(const std::vector<std::string>& args){
-    const char* path = args.size() > 1 ? args[1].c_str() : home_dir().c_str();
-    if(chdir(path) != 0) perror("cd");
+    std::string path = args.size() > 1 ? args[1] : home_dir();
+    if(chdir(path.c_str()) != 0){ perror("cd"); return 1; }
+    cwd = current_dir();
     return 0;
 }
-int Shell::builtin_pwd(){
-    char cwd[4096]; if(getcwd(cwd, sizeof(cwd))) std::cout << cwd << "\n";
+int Shell::builtin_pwd(std::ostream& os){
+    os << cwd << "\n";
     return 0;
 }
 int Shell::builtin_exit(){
     std::cout << "Bye!\n"; exit(0);
 }
-int Shell::builtin_jobs(){
+int Shell::builtin_jobs(const std::vector<std::string>& args, std::ostream& os){
+    if(args.size() > 1 && args[1]=="-o"){
+        if(args.size() < 3){ std::cerr << "jobs: usage: jobs -o %jobid [lines]\n"; return 1; }
+        int id = std::atoi(args[2][0]=='%'? args[2].c_str()+1 : args[2].c_str());
+        auto out = find_output(id);
+        if(!out){ std::cerr << "jobs: no captured output for job " << id << "\n"; return 1; }
+        int lines = args.size() > 3 ? std::atoi(args[3].c_str()) : 20;
+        os << out->tail(lines > 0 ? lines : 20);
+        os.flush();
+        return 0;
+    }
+    bool longfmt = args.size() > 1 && args[1]=="-l";
     std::lock_guard<std::mutex> lk(jobs_mtx);
     for(auto& [id, job] : jobs){
-        std::string st = (job.status==JobStatus::Running?"Running": job.status==JobStatus::Stopped?"Stopped":"Done");
-        std::cout << "["<<id<<"] " << (int)job.pgid << " " << st << "  " << job.command << (job.background?" &":"") << "\n";
+        std::string st = (job.status==JobStatus::Running?"Running": job.status==JobStatus::Stopped?"Stopped": job.timed_out?"Timed out":"Done");
+        os << "["<<id<<"] " << (int)job.pgid << " " << st << "  " << job.command << (job.background?" &":"") << "\n";
+        if(!longfmt) continue;
+        for(const auto& p: job.procs){
+            os << "      " << p.pid << " " << p.name << (p.done?" (done)": p.stopped?" (stopped)":"") << "\n";
+        }
+        os << "      placement: " << job.placement.describe() << "\n";
+        if(job.deadline_ns){
+            int64_t left = (int64_t)(job.deadline_ns - metrics::now_ns());
+            if(job.timed_out) os << "      deadline: passed, terminating\n";
+            else os << "      deadline: " << std::max<int64_t>(0, left / 1000000) / 1000.0 << "s left\n";
+        }
+        if(job.output){
+            std::lock_guard<std::mutex> olk(job.output->mtx);
+            os << "      output: " << job.output->ring.size() << " bytes buffered";
+            if(job.output->ring.dropped()) os << ", " << job.output->ring.dropped() << " dropped";
+            os << "\n";
+        }
+    }
+    // reported once, like a finished job
+    for(auto& [id, job] : timed_out_jobs){
+        os << "["<<id<<"] " << (int)job.pgid << " Timed out  " << job.command << (job.background?" &":"") << "\n";
     }
+    timed_out_jobs.clear();
     return 0;
 }
-int Shell::builtin_fg(const std::vector<std::string>& args){
-    if(args.size()<2){ std::cerr << "fg: usage: fg %jobid\n"; return 1; }
+
+// Pulls `--deadline=DUR` out of fg/bg arguments: -1 if malformed, 0 if absent.
+static int take_deadline_arg(std::vector<std::string>& args, uint64_t& ns){
+    int found = 0;
+    for(auto it = args.begin(); it != args.end();){
+        if(it->rfind("--deadline=", 0) != 0){ ++it; continue; }
+        if(!parse_duration(it->substr(11), ns)) return -1;
+        found = 1;
+        it = args.erase(it);
+    }
+    return found;
+}
+
+int Shell::builtin_fg(const std::vector<std::string>& argv){
+    std::vector<std::string> args = argv;
+    uint64_t deadline = 0;
+    int has_deadline = take_deadline_arg(args, deadline);
+    if(args.size()<2 || has_deadline < 0){ std::cerr << "fg: usage: fg [--deadline=DUR] %jobid\n"; return 1; }
     int id = std::stoi(args[1][0]=='%'? args[1].substr(1):args[1]);
-    Job* j = find_job_by_id(id);
-    if(!j){ std::cerr << "fg: no such job\n"; return 1; }
-    set_foreground_pgid(j->pgid);
-    if(j->status == JobStatus::Stopped){
-        kill(-j->pgid, SIGCONT);
-        j->status = JobStatus::Running;
-    }
-    int st = wait_for_job(j->pgid);
-    restore_shell_terminal();
-    return st;
+    pid_t pgid;
+    std::shared_ptr<JobOutput> out;
+    std::shared_ptr<MemoRun> memo;
+    {
+        std::lock_guard<std::mutex> lk(jobs_mtx);
+        auto it = jobs.find(id);
+        if(it == jobs.end()){ std::cerr << "fg: no such job\n"; return 1; }
+        pgid = it->second.pgid;
+        out = it->second.output;
+        memo = it->second.memo_run;
+        if(has_deadline) set_deadline(it->second, deadline);
+    }
+    // replay what the job wrote while in the background, then let the rest
+    // through as it arrives
+    if(out){
+        std::cout.flush();
+        out->attach();
+    }
+    bool gone;
+    {
+        // the reaper may have removed a background job that ended meanwhile
+        std::lock_guard<std::mutex> lk(jobs_mtx);
+        auto it = jobs.find(id);
+        gone = it == jobs.end();
+        if(!gone){
+            Job& j = it->second;
+            j.background = false;
+            j.waited = true;
+            if(j.status == JobStatus::Stopped){
+                for(auto& p: j.procs) p.stopped = false;
+                j.status = JobStatus::Running;
+                kill(-pgid, SIGCONT);
+            }
+        }
+    }
+    int st = 0;
+    if(!gone){
+        set_foreground_pgid(pgid);
+        st = wait_for_job(pgid, out);
+        restore_shell_terminal();
+    }
+    while(out){
+        // whatever the last writes left in the pipe
+        bool open = out->drain();
+        bool more = out->pending();
+        if(out->flush()) watch_output(out);
+        if(!open || !more){
+            out->detach();
+            break;
+        }
+    }
+    // a memoized job: the rest of its output, and the result if it is done
+    finish_memo_runs();
+    if(memo) memo->pass_on();
+    return exit_code(st);
 }
-int Shell::builtin_bg(const std::vector<std::string>& args){
-    if(args.size()<2){ std::cerr << "bg: usage: bg %jobid\n"; return 1; }
+int Shell::builtin_bg(const std::vector<std::string>& argv){
+    std::vector<std::string> args = argv;
+    uint64_t deadline = 0;
+    int has_deadline = take_deadline_arg(args, deadline);
+    if(args.size()<2 || has_deadline < 0){ std::cerr << "bg: usage: bg [--deadline=DUR] %jobid\n"; return 1; }
     int id = std::stoi(args[1][0]=='%'? args[1].substr(1):args[1]);
-    Job* j = find_job_by_id(id);
-    if(!j){ std::cerr << "bg: no such job\n"; return 1; }
-    if(j->status != JobStatus::Running){
-        kill(-j->pgid, SIGCONT);
-        j->status = JobStatus::Running;
+    std::lock_guard<std::mutex> lk(jobs_mtx);
+    auto it = jobs.find(id);
+    if(it == jobs.end()){ std::cerr << "bg: no such job\n"; return 1; }
+    Job& j = it->second;
+    if(has_deadline) set_deadline(j, deadline);
+    if(j.status == JobStatus::Stopped){
+        for(auto& p: j.procs) p.stopped = false;
+        j.status = JobStatus::Running;
+        kill(-j.pgid, SIGCONT);
     }
-    j->background = true;
+    j.background = true;
     return 0;
 }
 int Shell::builtin_kill(const std::vector<std::string>& args){
     if(args.size()<2){ std::cerr << "kill: usage: kill %jobid|pgid\n"; return 1; }
     if(args[1][0]=='%'){
         int id = std::stoi(args[1].substr(1));
-        Job* j = find_job_by_id(id);
-        if(!j){ std::cerr << "kill: no such job\n"; return 1; }
-        if(::kill(-j->pgid, SIGTERM)!=0) perror("kill");
+        pid_t pg;
+        {
+            std::lock_guard<std::mutex> lk(jobs_mtx);
+            auto it = jobs.find(id);
+            if(it == jobs.end()){ std::cerr << "kill: no such job\n"; return 1; }
+            pg = it->second.pgid;
+        }
+        if(::kill(-pg, SIGTERM)!=0) perror("kill");
     }else{
         pid_t pg = (pid_t)std::stol(args[1]);
         if(::kill(-pg, SIGTERM)!=0) perror("kill");
     }
     return 0;
 }
-int Shell::builtin_history(){
-    history->print();
+int Shell::builtin_history(std::ostream& os){
+    history->print(os);
+    return 0;
+}
+int Shell::builtin_prompt(const std::vector<std::string>& args){
+    if(args.size()<2){
+        std::cout << "layout: " << join(prompt_engine->layout(), " ") << "\n";
+        std::cout << "segments: " << join(prompt_engine->available(), " ") << "\n";
+        return 0;
+    }
+    std::vector<std::string> names(args.begin()+1, args.end());
+    if(!prompt_engine->set_layout(names)){
+        std::cerr << "prompt: unknown segment (see `prompt` for the list)\n";
+        return 1;
+    }
+    return 0;
+}
+
+int Shell::builtin_stats(const std::vector<std::string>& args, std::ostream& os){
+    const std::string sub = args.size() > 1 ? args[1] : "";
+    if(sub.empty()){
+        os << metrics::render_text();
+        if(!metrics::enabled()) os << "(collection is off)\n";
+        if(exporter) os << "exporting to " << exporter->target() << "\n";
+        if(size_t n = deadlines->size()) os << "deadlines pending: " << n << "\n";
+        return 0;
+    }
+    if(sub=="prom"){ os << metrics::render_prometheus(); return 0; }
+    if(sub=="reset"){ metrics::reset(); return 0; }
+    if(sub=="on" || sub=="off"){ metrics::set_enabled(sub=="on"); return 0; }
+    if(sub=="export" && args.size() > 2){
+        exporter.reset();
+        if(args[2]=="off") return 0;
+        int secs = args.size() > 3 ? std::atoi(args[3].c_str()) : 10;
+        if(secs <= 0) secs = 10;
+        exporter = std::make_unique<MetricsExporter>(args[2], secs * 1000);
+        if(!exporter->ok()){
+            std::cerr << "stats: cannot export to " << args[2] << "\n";
+            exporter.reset();
+            return 1;
+        }
+        return 0;
+    }
+    std::cerr << "stats: usage: stats [prom|reset|on|off|export <file|unix:path|off> [secs]]\n";
+    return 1;
+}
+
+Placer& Shell::placement(){
+    if(!placer) placer = std::make_unique<Placer>();
+    return *placer;
+}
+
+bool Shell::parse_pin_policy(const std::string& s, PlacementSpec& out){
+    PlacementSpec spec;
+    if(!parse_placement(s, spec)){
+        std::cerr << "pin: unknown policy: " << s << " (spread, compact[:N], node[:N], none)\n";
+        return false;
+    }
+    if(spec.node >= 0){
+        const auto& nodes = placement().topology().nodes;
+        if(spec.node >= (int)nodes.size() || nodes[spec.node].empty()){
+            std::cerr << "pin: no usable cpus on node " << spec.node << "\n";
+            return false;
+        }
+    }
+    out = spec;
+    return true;
+}
+
+int Shell::builtin_pin(const std::vector<std::string>& args){
+    if(args.size() > 2){ std::cerr << "pin: usage: pin [spread|compact[:N]|node[:N]|none] [command ...]\n"; return 1; }
+    if(args.size() == 2) return parse_pin_policy(args[1], default_placement) ? 0 : 1;
+    const Topology& t = placement().topology();
+    std::cout << "policy: " << placement_name(default_placement) << "\n";
+    std::cout << "cpus: " << cpu_list_string(t.cpus) << "\n";
+    for(size_t n=0;n<t.nodes.size();++n){
+        if(!t.nodes[n].empty()) std::cout << "node " << n << ": " << cpu_list_string(t.nodes[n]) << "\n";
+    }
+    for(size_t i=0;i<t.llcs.size();++i){
+        std::cout << "llc " << i << ": " << cpu_list_string(t.llcs[i]) << " (node " << t.llc_node[i] << ")\n";
+    }
     return 0;
 }
 
-int Shell::launch_pipeline(const Pipeline& pl){
+MemoStore& Shell::memo_store(){
+    if(!memo){
+        const char* xdg = std::getenv("XDG_CACHE_HOME");
+        std::string dir = (xdg && *xdg ? std::string(xdg) : home_dir() + "/.cache") + "/myshell/memo";
+        const char* mx = std::getenv("MYSHELL_MEMO_MAX_MB");
+        uint64_t mb = mx ? std::strtoull(mx, nullptr, 10) : 0;
+        memo = std::make_unique<MemoStore>(dir, (mb ? mb : 256) << 20);
+    }
+    return *memo;
+}
+
+int Shell::builtin_memo(const std::vector<std::string>& args){
+    const std::string sub = args.size() > 1 ? args[1] : "--stats";
+    if(args.size() <= 2 && sub=="--stats"){ std::cout << memo_store().stats(); return 0; }
+    if(args.size() == 2 && sub=="--clear"){ memo_store().clear(); return 0; }
+    if(args.size() == 2 && sub.rfind("--max=", 0) == 0){
+        char* end;
+        uint64_t n = std::strtoull(sub.c_str() + 6, &end, 10);
+        switch(*end){
+        case 'G': case 'g': n <<= 30; break;
+        case 'M': case 'm': case '\0': n <<= 20; break;
+        case 'K': case 'k': n <<= 10; break;
+        default: n = 0;
+        }
+        if(n){ memo_store().set_max_bytes(n); return 0; }
+    }
+    std::cerr << "memo: usage: memo [-e VAR] [-i FILE] command ... | memo --stats | --clear | --max=SIZE[K|M|G]\n";
+    return 1;
+}
+
+// An unnamed scratch file for captured output; lives only as long as the fd.
+static int scratch_fd(const std::string& dir){
+    int fd = open(dir.c_str(), O_TMPFILE|O_RDWR|O_CLOEXEC, 0600);
+    if(fd >= 0) return fd;
+    std::string tmp = dir + "/.out-XXXXXX";
+    fd = mkostemp(&tmp[0], O_CLOEXEC);
+    if(fd >= 0) unlink(tmp.c_str());
+    return fd;
+}
+
+// memo: replay a cached result, or run the job with its stdout/stderr
+// captured, pass the output on and cache it. Output of a miss therefore shows
+// up when the job finishes rather than as it is produced.
+int Shell::launch_memoized(const Pipeline& pl, const std::string& printable, const JobOptions& opts){
+    MemoStore& store = memo_store();
+    JobOptions plain = opts;
+    plain.memo = false;
+    if(pl.background){
+        std::cerr << "memo: background jobs are not cached\n";
+        return launch_job(pl, printable, plain);
+    }
+    MemoKey key;
+    std::string err;
+    bool keyed;
+    {
+        metrics::ScopedTimer t(metrics::MemoKeyNs);
+        trace::Span span("memo_key", printable);
+        keyed = memo_key(pl, opts.memo_env, opts.memo_inputs, cwd, key, err);
+    }
+    if(!keyed){
+        std::cerr << "memo: " << err << " (not cached)\n";
+        ++store.uncacheable;
+        return launch_job(pl, printable, plain);
+    }
+
+    const Command& last = pl.cmds.back();
+    int dest = STDOUT_FILENO;
+    if(!last.out.empty()){
+        dest = open(last.out.c_str(), O_WRONLY|O_CREAT|O_CLOEXEC|(last.append_out? O_APPEND: O_TRUNC), 0644);
+        if(dest < 0){ perror("open >"); return 1; }
+    }
+    std::cout.flush();
+    std::cerr.flush();
+
+    MemoEntry e;
+    if(store.lookup(key, e)){
+        metrics::inc(metrics::MemoHits);
+        memo_copy(e.fd, e.out_off, e.out_len, dest);
+        memo_copy(e.fd, e.err_off, e.err_len, STDERR_FILENO);
+        close(e.fd);
+        if(dest != STDOUT_FILENO) close(dest);
+        return e.status;
+    }
+    metrics::inc(metrics::MemoMisses);
+
+    auto run = std::make_shared<MemoRun>();
+    run->key = key;
+    run->dest = dest == STDOUT_FILENO ? -1 : dest;
+    run->timeout = opts.timeout_ns != 0;
+    run->out = scratch_fd(store.directory());
+    run->err = run->out >= 0 ? scratch_fd(store.directory()) : -1;
+    if(run->err < 0){
+        perror("memo");
+        return 1;
+    }
+    Pipeline r = pl;
+    r.cmds.back().out.clear();
+    plain.out_fd = run->out;
+    plain.err_fd = run->err;
+    pid_t pgid = 0;
+    int code = launch_job(r, printable, plain, &pgid);
+
+    bool stopped = false;
+    {
+        // a stopped job keeps writing to the scratch files once it is
+        // continued, so they stay with it until it ends; see finish_memo_runs
+        std::lock_guard<std::mutex> lk(jobs_mtx);
+        auto it = pgid_to_id.find(pgid);
+        auto j = it == pgid_to_id.end() ? jobs.end() : jobs.find(it->second);
+        if(j != jobs.end() && j->second.status == JobStatus::Stopped){
+            j->second.memo_run = run;
+            stopped = true;
+        }
+    }
+    if(stopped) run->pass_on();
+    else finish_memo(*run, code);
+    return code;
+}
+
+void Shell::finish_memo(MemoRun& run, int code){
+    MemoStore& store = memo_store();
+    run.pass_on();
+    // signalled, stopped (128+sig) or timed out runs are not a result worth replaying
+    if(code < 128 && !(run.timeout && code == 124)) store.store(run.key, code, run.out, run.err);
+    else ++store.uncacheable;
+}
+
+// Main thread: completes memoized runs whose job ended after a stop, once
+// fg or the reaper has removed the job.
+void Shell::finish_memo_runs(){
+    std::vector<std::pair<std::shared_ptr<MemoRun>, int>> done;
+    {
+        std::lock_guard<std::mutex> lk(jobs_mtx);
+        done.swap(finished_memo);
+    }
+    if(done.empty()) return;
+    std::cout.flush();
+    for(auto& [run, code] : done) finish_memo(*run, code);
+}
+
+int Shell::builtin_capture(const std::vector<std::string>& args){
+    if(args.size() < 2){
+        std::cout << "capture: " << (capture_bg ? "on" : "off") << " (" << (capture_bytes.load() >> 10) << " KiB per job)\n";
+        return 0;
+    }
+    if(args[1]=="off" && args.size()==2){ capture_bg = false; return 0; }
+    if(args[1]=="on" && args.size() <= 3){
+        if(args.size()==3){
+            long kib = std::atol(args[2].c_str());
+            if(kib <= 0){ std::cerr << "capture: bad size: " << args[2] << "\n"; return 1; }
+            capture_bytes = (size_t)kib << 10;
+        }
+        capture_bg = true;
+        return 0;
+    }
+    std::cerr << "capture: usage: capture [on [KiB]|off]\n";
+    return 1;
+}
+
+// Ring buffer + pipe for a background job's output. Returns the write end
+// for the children in `write_fd`; the read end stays with the JobOutput.
+std::shared_ptr<JobOutput> Shell::open_capture(int job_id, int& write_fd){
+    auto out = std::make_shared<JobOutput>(capture_bytes, "myshell-job-" + std::to_string(job_id));
+    int p[2];
+    if(!out->ring.ok() || pipe2(p, O_CLOEXEC) < 0) return nullptr;
+    fcntl(p[0], F_SETFL, O_NONBLOCK);
+    // a bigger pipe absorbs bursts between two drains (best effort)
+    fcntl(p[0], F_SETPIPE_SZ, 1 << 20);
+    out->fd = p[0];
+    write_fd = p[1];
+    return out;
+}
+
+void Shell::watch_output(const std::shared_ptr<JobOutput>& out){
+    int fd = out->fd;
+    EventLoop* loop = events.get();
+    events->add(fd, EPOLLIN, [this, loop, out, fd](uint32_t){
+        bool open = out->drain();
+        if(out->pending()){
+            // the foreground thread writes it out; see wait_for_job
+            std::lock_guard<std::mutex> lk(jobs_mtx);
+            jobs_cv.notify_all();
+        }
+        if(open){
+            // in passthrough, stop reading while the ring is full: the job
+            // blocks on the pipe until the foreground thread has caught up
+            std::lock_guard<std::mutex> lk(out->mtx);
+            if(out->passthrough && out->ring.size() == out->ring.capacity()){
+                out->paused = true;
+                loop->remove(fd);
+            }
+            return;
+        }
+        loop->remove(fd);
+        std::lock_guard<std::mutex> lk(out->mtx);
+        close(out->fd);
+        out->fd = -1;
+    });
+}
+
+std::shared_ptr<JobOutput> Shell::find_output(int id){
+    std::lock_guard<std::mutex> lk(jobs_mtx);
+    auto j = jobs.find(id);
+    if(j != jobs.end()) return j->second.output;
+    auto f = finished_output.find(id);
+    return f != finished_output.end() ? f->second : nullptr;
+}
+
+struct ChangeWatch {
+    int id{0};
+    std::string desc;                   // as typed, for listing
+    std::unique_ptr<FileWatcher> fw;
+    int timer{-1};                      // debounce timerfd
+    int debounce_ms{100};
+    bool cancel{false};                 // restart an in-flight run instead of queueing
+    Pipeline pl;
+    std::string printable;
+    JobOptions opts;
+    std::set<std::string> changed;      // since the last launch
+    bool pending{false};                // a run is queued behind the current one
+    pid_t pgid{0};                      // current / last run
+    uint64_t runs{0};
+    ~ChangeWatch(){ if(timer >= 0) close(timer); }
+};
+
+// `on-change [-r] [-d ms] [--cancel|--queue] <paths/globs> -- <pipeline>`
+int Shell::add_watch(Pipeline& pl){
+    auto& argv = pl.cmds[0].argv;
+    auto sep = std::find(argv.begin(), argv.end(), "--");
+    auto w = std::make_shared<ChangeWatch>();
+    std::vector<std::string> specs;
+    bool recursive = false;
+    for(auto it = argv.begin() + 1; it != sep; ++it){
+        if(*it == "-r") recursive = true;
+        else if(*it == "--cancel") w->cancel = true;
+        else if(*it == "--queue") w->cancel = false;
+        else if(*it == "-d" && it + 1 != sep) w->debounce_ms = std::max(0, std::atoi((++it)->c_str()));
+        else if((*it)[0] == '-'){ specs.clear(); break; }
+        else specs.push_back(*it);
+    }
+    if(specs.empty() || sep + 1 == argv.end()){
+        std::cerr << "on-change: usage: on-change [-r] [-d ms] [--cancel|--queue] <paths/globs> -- <pipeline>\n";
+        return 1;
+    }
+    w->desc = join(std::vector<std::string>(argv.begin() + 1, sep), " ");
+    argv.erase(argv.begin(), sep + 1);
+
+    w->opts.placement = default_placement;
+    w->opts.in_fd = stream_stdin;
+    if(!take_prefixes(pl, w->opts)) return 2;
+    if(w->opts.memo){
+        // runs are background jobs, which memo doesn't cache
+        std::cerr << "on-change: memo is not supported for watched pipelines\n";
+        return 1;
+    }
+    if(w->opts.placement.policy != PlacementPolicy::None) placement();
+    // runs start from the event loop whatever the shell's cwd is by then
+    w->opts.cwd = cwd;
+    pl.background = true;
+    std::vector<std::string> parts;
+    for(const auto& c: pl.cmds) parts.push_back(join(c.argv, " "));
+    w->printable = join(parts, " | ");
+    w->pl = pl;
+
+    w->fw = std::make_unique<FileWatcher>(recursive, cwd);
+    if(!w->fw->ok()){ perror("on-change: inotify"); return 1; }
+    for(const auto& sp: specs){
+        std::string err;
+        if(!w->fw->add(sp, err)){ std::cerr << "on-change: " << err << "\n"; return 1; }
+    }
+    w->timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+    if(w->timer < 0){ perror("on-change: timerfd"); return 1; }
+
+    {
+        std::lock_guard<std::mutex> lk(watch_mtx);
+        w->id = next_watch_id++;
+        watches[w->id] = w;
+    }
+    // changes (re)arm the debounce timer, so a burst of writes is one run
+    events->add(w->fw->fileno(), EPOLLIN, [this, w](uint32_t){
+        std::lock_guard<std::mutex> lk(watch_mtx);
+        w->fw->read_events(w->changed);
+        if(w->changed.empty()) return;
+        itimerspec its{};
+        its.it_value.tv_sec = w->debounce_ms / 1000;
+        its.it_value.tv_nsec = (w->debounce_ms % 1000) * 1000000L + 1;
+        timerfd_settime(w->timer, 0, &its, nullptr);
+    });
+    events->add(w->timer, EPOLLIN, [this, w](uint32_t){
+        uint64_t n;
+        if(read(w->timer, &n, sizeof(n)) != sizeof(n)) return;
+        std::lock_guard<std::mutex> lk(watch_mtx);
+        fire_watch(*w);
+    });
+    std::cout << "on-change [" << w->id << "] watching " << w->fw->watch_count() << " director"
+              << (w->fw->watch_count()==1 ? "y" : "ies") << "\n";
+    return 0;
+}
+
+// watch_mtx must be held
+bool Shell::watch_running(const ChangeWatch& w){
+    if(!w.pgid) return false;
+    std::lock_guard<std::mutex> lk(jobs_mtx);
+    auto it = pgid_to_id.find(w.pgid);
+    return it != pgid_to_id.end() && jobs[it->second].status != JobStatus::Done;
+}
+
+// watch_mtx must be held
+void Shell::launch_watch(ChangeWatch& w){
+    JobOptions opts = w.opts;
+    std::string files;
+    for(const auto& f: w.changed) files += (files.empty() ? "" : "\n") + f;
+    opts.env.push_back("MYSHELL_CHANGED_FILES=" + files);
+    opts.quiet = true;      // event loop thread: std::cout belongs to the main one
+    w.changed.clear();
+    w.pending = false;
+    pid_t pgid = 0;
+    launch_job(w.pl, w.printable, opts, &pgid);
+    w.pgid = pgid;
+    ++w.runs;
+}
+
+// watch_mtx must be held
+void Shell::fire_watch(ChangeWatch& w){
+    if(w.changed.empty()) return;
+    if(watch_running(w)){
+        if(!w.cancel){ w.pending = true; return; }
+        kill(-w.pgid, SIGTERM);
+    }
+    launch_watch(w);
+}
+
+// After every reap: start runs that were queued behind one that just ended.
+void Shell::service_watches(){
+    std::lock_guard<std::mutex> lk(watch_mtx);
+    for(auto& [id, w] : watches){
+        if(w->pending && !watch_running(*w)) launch_watch(*w);
+    }
+}
+
+int Shell::builtin_on_change(const std::vector<std::string>& args){
+    if(args.size() == 3 && args[1] == "-k"){
+        int id = std::atoi(args[2].c_str());
+        std::shared_ptr<ChangeWatch> w;
+        {
+            std::lock_guard<std::mutex> lk(watch_mtx);
+            auto it = watches.find(id);
+            if(it == watches.end()){ std::cerr << "on-change: no such watch\n"; return 1; }
+            w = it->second;
+            watches.erase(it);
+        }
+        events->remove(w->fw->fileno());
+        events->remove(w->timer);
+        return 0;
+    }
+    if(args.size() > 1){
+        std::cerr << "on-change: usage: on-change [-k id] | on-change [-r] [-d ms] [--cancel|--queue] <paths/globs> -- <pipeline>\n";
+        return 1;
+    }
+    std::lock_guard<std::mutex> lk(watch_mtx);
+    for(const auto& [id, w] : watches){
+        int job = 0;
+        if(w->pgid){
+            std::lock_guard<std::mutex> jl(jobs_mtx);
+            auto it = pgid_to_id.find(w->pgid);
+            if(it != pgid_to_id.end() && jobs[it->second].status != JobStatus::Done) job = it->second;
+        }
+        std::cout << "[" << id << "] " << w->desc << " -- " << w->printable << "  ("
+                  << (w->cancel ? "cancel" : "queue") << ", " << w->debounce_ms << " ms, " << w->runs << " runs";
+        if(job) std::cout << ", running as %" << job;
+        std::cout << ")\n";
+    }
+    return 0;
+}
+
+int Shell::launch_pipeline(const Pipeline& pl, const JobOptions& opts){
     // Build printable command
     std::vector<std::string> parts;
     for(const auto& c: pl.cmds){
@@ -271,28 +1206,91 @@ int Shell::launch_pipeline(const Pipeline& pl){
     }
     std::string printable = join(parts, " | ");
     if(pl.background) printable += " &";
-    return launch_job(pl, printable);
+    if(opts.memo) return launch_memoized(pl, printable, opts);
+    return launch_job(pl, printable, opts);
+}
+
+// The errpipes of a job's stages are read on the event loop rather than here:
+// a stage can block indefinitely before exec (`cat < fifo`), and the shell
+// must not block with it. Spawn latency is taken when the last one closes.
+void Shell::watch_exec(const std::vector<Process>& procs, const std::vector<int>& errpipes, uint64_t spawn_t0){
+    auto left = std::make_shared<size_t>(procs.size());
+    for(size_t i=0;i<procs.size();++i){
+        int fd = errpipes[2*i];
+        std::string name = procs[i].name;
+        uint64_t start = procs[i].start_ns;
+        bool ok = events->add(fd, EPOLLIN, [this, left, fd, name, start, spawn_t0](uint32_t){
+            int e;
+            ssize_t r = read(fd, &e, sizeof(e));
+            if(r > 0){ metrics::inc(metrics::ExecFailures); return; }
+            if(r < 0 && (errno == EINTR || errno == EAGAIN)) return;
+            events->remove(fd);
+            close(fd);
+            uint64_t now = metrics::now_ns();
+            trace::complete("exec", name, start, now - start);
+            if(--*left == 0) metrics::record(metrics::SpawnNs, now - spawn_t0);
+        });
+        if(!ok) close(fd);
+    }
 }
 
-int Shell::launch_job(const Pipeline& pl, const std::string& printable){
+int Shell::launch_job(const Pipeline& pl, const std::string& printable, const JobOptions& job_opts, pid_t* pgid_out){
     size_t n = pl.cmds.size();
+    if(!job_opts.quiet) std::cout.flush();  // or builtin output still buffered shows up after the job's
     std::vector<int> pipes;
     pipes.resize((n>1)? 2*(n-1): 0);
     for(size_t i=0;i+1<n;++i){
-        if(pipe(&pipes[2*i])<0){ perror("pipe"); return 1; }
+        if(pipe2(&pipes[2*i], O_CLOEXEC)<0){ perror("pipe"); return 1; }
+    }
+    // exec errors are reported back over a close-on-exec pipe per stage: EOF
+    // means the stage reached exec (or died), an int is an errno from execvp
+    std::vector<int> errpipes(2*n);
+    for(size_t i=0;i<n;++i){
+        if(pipe2(&errpipes[2*i], O_CLOEXEC|O_NONBLOCK)<0){ perror("pipe"); return 1; }
     }
 
+    Job job;
+    job.id = next_job_id();
+    JobOptions opts = job_opts;
+    int capture_fd = -1;
+    if(pl.background && capture_bg && opts.out_fd < 0 && opts.err_fd < 0){
+        job.output = open_capture(job.id, capture_fd);
+        if(!job.output) perror("capture");
+        opts.out_fd = opts.err_fd = capture_fd;
+    }
+    if(opts.placement.policy != PlacementPolicy::None) job.placement = placement().assign(opts.placement, n);
     pid_t pgid = 0;
-    std::vector<pid_t> pids;
+    uint64_t spawn_t0 = metrics::now_ns();
+
+    // argv and envp are built here: between fork and exec the child of a
+    // multithreaded process must not allocate
+    std::vector<std::vector<char*>> argvs(n);
+    for(size_t i=0;i<n;++i){
+        for(const auto& a: pl.cmds[i].argv) argvs[i].push_back(const_cast<char*>(a.c_str()));
+        argvs[i].push_back(nullptr);
+    }
+    std::vector<char*> envp;
+    if(!opts.env.empty()){
+        for(char** e = environ; *e; ++e){
+            const char* eq = strchr(*e, '=');
+            size_t len = eq ? eq - *e + 1 : strlen(*e);
+            bool overridden = std::any_of(opts.env.begin(), opts.env.end(),
+                                          [&](const std::string& v){ return v.compare(0, len, *e, len) == 0; });
+            if(!overridden) envp.push_back(*e);
+        }
+        for(const auto& v: opts.env) envp.push_back(const_cast<char*>(v.c_str()));
+        envp.push_back(nullptr);
+    }
 
     for(size_t i=0;i<n;++i){
+        uint64_t t0 = metrics::now_ns();
         pid_t pid = fork();
         if(pid==0){
             // Child
             // New process group
             if(pgid == 0) pgid = getpid();
             setpgid(getpid(), pgid);
-            if(!pl.background) tcsetpgrp(STDIN_FILENO, pgid);
+            if(!pl.background && !opts.detached) tcsetpgrp(STDIN_FILENO, pgid);
 
             // Restore default signals
             signal(SIGINT, SIG_DFL);
@@ -313,6 +1311,16 @@ int Shell::launch_job(const Pipeline& pl, const std::string& printable){
                 // close all pipe fds
                 for(size_t k=0;k<pipes.size();++k) close(pipes[k]);
             }
+            // stdin/stdout/stderr overrides; explicit redirections below still win
+            if(opts.in_fd >= 0 && i == 0) dup2(opts.in_fd, STDIN_FILENO);
+            if(opts.out_fd >= 0 && i+1 == n) dup2(opts.out_fd, STDOUT_FILENO);
+            if(opts.err_fd >= 0) dup2(opts.err_fd, STDERR_FILENO);
+
+            if(!opts.cwd.empty() && chdir(opts.cwd.c_str()) != 0){
+                static const char msg[] = "myshell: cannot enter the job's directory\n";
+                (void)!write(STDERR_FILENO, msg, sizeof(msg) - 1);
+                _exit(1);
+            }
 
             // redirections
             const auto& cmd = pl.cmds[i];
@@ -328,83 +1336,230 @@ int Shell::launch_job(const Pipeline& pl, const std::string& printable){
                 dup2(fd, STDOUT_FILENO); close(fd);
             }
 
+            apply_placement(job.placement);
+
             // exec
-            std::vector<char*> argv;
-            for(const auto& s: cmd.argv) argv.push_back(const_cast<char*>(s.c_str()));
-            argv.push_back(nullptr);
-            execvp(argv[0], argv.data());
+            char** argv = argvs[i].data();
+            execvpe(argv[0], argv, envp.empty() ? environ : envp.data());
+            int e = errno;
+            (void)!write(errpipes[2*i+1], &e, sizeof(e));
             perror("execvp");
             _exit(127);
         }else if(pid>0){
             // Parent
+            uint64_t t1 = metrics::now_ns();
+            metrics::record(metrics::ForkNs, t1 - t0);
+            metrics::inc(metrics::Forks);
+            trace::complete("fork", pl.cmds[i].argv[0], t0, t1 - t0);
+            close(errpipes[2*i+1]);
             if(pgid==0) pgid = pid;
             setpgid(pid, pgid);
-            pids.push_back(pid);
+            Process p;
+            p.pid = pid;
+            p.name = pl.cmds[i].argv[0];
+            p.start_ns = t1;
+            job.procs.push_back(p);
+            {
+                // from here on the reaper can attribute the pid; a status it
+                // gets before add_job is parked and collected there
+                std::lock_guard<std::mutex> lk(jobs_mtx);
+                pid_to_id[pid] = job.id;
+            }
+            if(trace::enabled()){
+                trace::name_track(trace::JobProcesses, pid, "[" + std::to_string(job.id) + "] " + join(pl.cmds[i].argv, " "));
+            }
         }else{
             perror("fork");
-            return 1;
+            metrics::inc(metrics::ForkFailures);
+            for(size_t k=i;k<n;++k){ close(errpipes[2*k]); close(errpipes[2*k+1]); }
+            // don't leave a half-built pipeline running
+            if(pgid) kill(-pgid, SIGKILL);
+            break;
         }
     }
 
     // parent closes pipes
     for(size_t k=0;k<pipes.size();++k) close(pipes[k]);
+    if(capture_fd >= 0){
+        close(capture_fd);
+        watch_output(job.output);
+    }
+    watch_exec(job.procs, errpipes, spawn_t0);
+    if(job.procs.empty()){
+        if(placer) placer->release(job.placement);
+        return 1;
+    }
+    bool partial = job.procs.size() < n;
+    metrics::inc(metrics::Jobs);
 
     // register job
-    Job job;
-    job.id = next_job_id();
     job.pgid = pgid;
     job.command = printable;
     job.status = JobStatus::Running;
     job.background = pl.background;
-    job.pids = pids;
+    job.waited = !pl.background;    // detached too: the caller waits
     add_job(job);
+    if(opts.timeout_ns){
+        std::lock_guard<std::mutex> lk(jobs_mtx);
+        auto it = jobs.find(job.id);
+        if(it != jobs.end()){
+            it->second.kill_after_ns = opts.kill_after_ns;
+            set_deadline(it->second, opts.timeout_ns);
+        }
+    }
 
+    if(pgid_out) *pgid_out = pgid;
+    if(opts.detached) return partial ? 1 : 0;
     if(pl.background){
-        active_bg_jobs.fetch_add(1);
+        // a half-built pipeline was killed; the reaper collects it
+        if(partial) return 1;
+        if(opts.quiet) return 0;
         std::cout << "["<<job.id<<"] "<< pgid << " " << printable << "\n";
+        std::cout.flush();
         return 0;
     }else{
         set_foreground_pgid(pgid);
         int st = wait_for_job(pgid);
         restore_shell_terminal();
-        return st;
+        return partial ? 1 : exit_code(st);
     }
 }
 
-int Shell::wait_for_job(pid_t pgid){
-    int status = 0;
-    pid_t pid;
-    do{
-        pid = waitpid(-pgid, &status, WUNTRACED);
-    }while(pid>0 && !WIFEXITED(status) && !WIFSIGNALED(status) && !WIFSTOPPED(status));
-    // update status
+// Blocks until the job stops or finishes; the reaper thread does the actual
+// waitpid calls and wakes us through jobs_cv. Finished jobs are removed here.
+int Shell::wait_for_job(pid_t pgid, const std::shared_ptr<JobOutput>& out){
+    metrics::ScopedTimer t(metrics::WaitNs);
+    std::unique_lock<std::mutex> lk(jobs_mtx);
+    auto it = pgid_to_id.find(pgid);
+    if(it==pgid_to_id.end()) return 0;
+    int id = it->second;
+    trace::Span span("wait", jobs[id].command);
+    auto running = [&]{
+        auto j = jobs.find(id);
+        return j!=jobs.end() && j->second.status == JobStatus::Running;
+    };
+    while(true){
+        jobs_cv.wait(lk, [&]{ return !running() || (out && out->pending()); });
+        if(!out || !out->pending()) break;
+        // captured output of a job in the foreground is written from here
+        lk.unlock();
+        if(out->flush()) watch_output(out);
+        lk.lock();
+        if(!running()) break;
+    }
+    auto j = jobs.find(id);
+    if(j==jobs.end()) return 0;
+    Job& job = j->second;
+    if(job.status == JobStatus::Stopped){
+        // nobody waits for it now; if it ends without fg the reaper removes it
+        job.background = false;
+        job.waited = false;
+        for(const auto& p: job.procs) if(p.stopped) return p.status;
+        return 0;
+    }
+    int status = job.procs.back().status;
+    if(job.timed_out) status = 124 << 8;    // exit status 124, as timeout(1)
+    if(job.memo_run) finished_memo.emplace_back(std::move(job.memo_run), exit_code(status));
+    if(placer) placer->release(job.placement);
+    if(job.deadline_seq) deadlines->cancel(job.id);
+    pgid_to_id.erase(job.pgid);
+    jobs.erase(j);
+    return status;
+}
+
+void Shell::add_job(const Job& job){
+    std::lock_guard<std::mutex> lk(jobs_mtx);
+    Job& j = jobs[job.id] = job;
+    pgid_to_id[job.pgid] = job.id;
+    for(auto& p: j.procs){
+        pid_to_id[p.pid] = job.id;
+        auto u = unclaimed.find(p.pid);
+        if(u!=unclaimed.end()){
+            update_process(j, p, u->second);
+            unclaimed.erase(u);
+        }
+    }
+}
+
+// jobs_mtx must be held
+void Shell::update_process(Job& job, Process& p, int status){
     if(WIFSTOPPED(status)){
+        p.stopped = true;
+        p.status = status;
+    }else if(WIFCONTINUED(status)){
+        p.stopped = false;
+    }else{
+        p.done = true;
+        p.stopped = false;
+        p.status = status;
+        pid_to_id.erase(p.pid);
+        trace::complete("process", p.name, p.start_ns, metrics::now_ns() - p.start_ns, trace::JobProcesses, p.pid);
+    }
+    bool all_done = true, any_stopped = false;
+    for(const auto& q: job.procs){
+        all_done = all_done && q.done;
+        any_stopped = any_stopped || q.stopped;
+    }
+    job.status = all_done ? JobStatus::Done : any_stopped ? JobStatus::Stopped : JobStatus::Running;
+}
+
+void Shell::reap_children(){
+    int status;
+    pid_t pid;
+    while((pid = waitpid(-1, &status, WNOHANG|WUNTRACED|WCONTINUED)) > 0){
         std::lock_guard<std::mutex> lk(jobs_mtx);
-        auto it = pgid_to_id.find(pgid);
-        if(it!=pgid_to_id.end()){
-            jobs[it->second].status = JobStatus::Stopped;
-            jobs[it->second].background = false;
-            active_bg_jobs.fetch_add(1);
+        auto it = pid_to_id.find(pid);
+        auto j = it==pid_to_id.end() ? jobs.end() : jobs.find(it->second);
+        if(j==jobs.end()){
+            unclaimed[pid] = status;
+            continue;
         }
-    }else{
+        Job& job = j->second;
+        for(auto& p: job.procs){
+            if(p.pid == pid){ update_process(job, p, status); break; }
+        }
+    }
+    jobs_cv.notify_all();
+}
+
+// jobs_mtx must be held. Replaces any earlier deadline; 0 clears it.
+void Shell::set_deadline(Job& job, uint64_t after_ns){
+    job.deadline_seq = ++last_deadline_seq;
+    job.timed_out = false;
+    job.deadline_ns = after_ns ? metrics::now_ns() + after_ns : 0;
+    if(after_ns) deadlines->add({job.deadline_ns, job.id, job.deadline_seq, false});
+    else deadlines->cancel(job.id);
+}
+
+// Event loop: SIGTERM (and SIGCONT, so a stopped job can act on it) at the
+// deadline, then SIGKILL kill_after_ns later if the job is still there.
+void Shell::expire_deadlines(){
+    for(const auto& e: deadlines->expired()){
         std::lock_guard<std::mutex> lk(jobs_mtx);
-        auto it = pgid_to_id.find(pgid);
-        if(it!=pgid_to_id.end()){
-            jobs[it->second].status = JobStatus::Done;
-            if(jobs[it->second].background) active_bg_jobs.fetch_sub(1);
+        auto it = jobs.find(e.job_id);
+        if(it == jobs.end()) continue;
+        Job& job = it->second;
+        if(job.deadline_seq != e.seq || job.status == JobStatus::Done) continue;
+        if(e.kill){
+            kill(-job.pgid, SIGKILL);
+            continue;
         }
+        job.timed_out = true;
+        metrics::inc(metrics::Timeouts);
+        kill(-job.pgid, SIGTERM);
+        kill(-job.pgid, SIGCONT);
+        if(job.kill_after_ns) deadlines->add({metrics::now_ns() + job.kill_after_ns, job.id, job.deadline_seq, true});
     }
-    return status;
 }
 
-void Shell::add_job(const Job& job){
-    std::lock_guard<std::mutex> lk(jobs_mtx);
-    jobs[job.id] = job;
-    pgid_to_id[job.pgid] = job.id;
+int Shell::builtin_timeout(const std::vector<std::string>&){
+    // only reached when there is no command to run; see take_prefixes
+    std::cerr << "timeout: usage: timeout [-k DUR] DUR command ...\n";
+    return 1;
 }
 
 int Shell::next_job_id(){
-    static int cur=1;
+    static std::atomic<int> cur{1};     // on-change launches from the event loop thread
     return cur++;
 }
 
@@ -431,36 +1586,44 @@ void Shell::restore_shell_terminal(){
 }
 
 void Shell::sigchld_handler(int){
-    // Reap without blocking
-    int status;
-    pid_t pid;
-    while((pid = waitpid(-1, &status, WNOHANG|WUNTRACED|WCONTINUED)) > 0){
-        if(WIFEXITED(status) || WIFSIGNALED(status)){
-            // mark as done handled in check_for_terminated_jobs
-        }
-    }
+    // only wake the reaper; waitpid runs on the monitor thread
+    int saved = errno;
+    char c = 1;
+    (void)!write(g_sigchld_pipe[1], &c, 1);
+    errno = saved;
 }
 
 void Shell::check_for_terminated_jobs(){
     std::lock_guard<std::mutex> lk(jobs_mtx);
     std::vector<int> to_erase;
+    int active = 0;
     for(auto& [id, job] : jobs){
-        // Check any process alive in group
-        bool alive = false;
-        for(pid_t p : job.pids){
-            if(kill(p, 0) == 0){ alive = true; break; }
-        }
-        if(!alive && job.status != JobStatus::Done){
-            job.status = JobStatus::Done;
-            if(job.background) active_bg_jobs.fetch_sub(1);
-        }
-        if(job.status == JobStatus::Done){
+        // jobs someone waits for are removed by wait_for_job once it has the status
+        if(job.status == JobStatus::Done && !job.waited){
             to_erase.push_back(id);
+        }else if(job.status != JobStatus::Done && (job.background || job.status == JobStatus::Stopped)){
+            ++active;
         }
     }
     for(int id: to_erase){
+        if(jobs[id].output){
+            finished_output[id] = jobs[id].output;
+            if(finished_output.size() > 16) finished_output.erase(finished_output.begin());
+        }
+        if(jobs[id].memo_run){
+            int st = jobs[id].timed_out ? 124 << 8 : jobs[id].procs.back().status;
+            finished_memo.emplace_back(std::move(jobs[id].memo_run), exit_code(st));
+        }
+        if(jobs[id].timed_out){
+            timed_out_jobs[id] = jobs[id];
+            if(timed_out_jobs.size() > 16) timed_out_jobs.erase(timed_out_jobs.begin());
+        }
+        if(placer) placer->release(jobs[id].placement);
+        if(jobs[id].deadline_seq) deadlines->cancel(id);
+        pgid_to_id.erase(jobs[id].pgid);
         jobs.erase(id);
     }
+    active_bg_jobs.store(active);
 }
 
 void Shell::update_prompt_jobs_hint(){
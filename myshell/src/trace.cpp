@@ -0,0 +1,142 @@
+#include "trace.hpp"
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+namespace trace {
+
+struct Event {
+    const char* name;       // string literal, or nullptr for a track-name record
+    char detail[96];
+    uint64_t ts, dur;
+    int group, track;
+};
+
+// Single-producer chunk list: only the owning thread appends, and it
+// publishes each event with a release store of `n`; the writer at exit reads
+// `n` with acquire and never touches slots beyond it.
+struct Chunk {
+    static constexpr size_t CAP = 1024;
+    Event ev[CAP];
+    std::atomic<size_t> n{0};
+    std::atomic<Chunk*> next{nullptr};
+};
+
+struct Buffer {
+    Chunk* head;
+    Chunk* tail;
+    int tid;
+};
+
+static std::atomic<bool> g_enabled{false};
+static std::string g_path;
+static std::mutex g_mtx;                 // guards registration and finish only
+static std::vector<Buffer*> g_buffers;
+static uint64_t g_epoch;
+
+static Buffer& buffer(){
+    thread_local Buffer* b = nullptr;
+    if(!b){
+        b = new Buffer{new Chunk, nullptr, (int)syscall(SYS_gettid)};
+        b->tail = b->head;
+        std::lock_guard<std::mutex> lk(g_mtx);
+        g_buffers.push_back(b);
+    }
+    return *b;
+}
+
+static void append(const char* name, const std::string& detail, uint64_t ts, uint64_t dur, int group, int track){
+    Buffer& b = buffer();
+    Chunk* c = b.tail;
+    size_t i = c->n.load(std::memory_order_relaxed);
+    if(i == Chunk::CAP){
+        Chunk* nc = new Chunk;
+        c->next.store(nc, std::memory_order_release);
+        b.tail = c = nc;
+        i = 0;
+    }
+    Event& e = c->ev[i];
+    e.name = name;
+    size_t len = std::min(detail.size(), sizeof(e.detail) - 1);
+    memcpy(e.detail, detail.data(), len);
+    e.detail[len] = '\0';
+    e.ts = ts;
+    e.dur = dur;
+    e.group = group;
+    e.track = track ? track : b.tid;
+    c->n.store(i + 1, std::memory_order_release);
+}
+
+bool enabled(){ return g_enabled.load(std::memory_order_relaxed); }
+
+bool start(const std::string& path){
+    FILE* f = fopen(path.c_str(), "w");
+    if(!f) return false;
+    fclose(f);
+    g_path = path;
+    g_epoch = metrics::now_ns();
+    g_enabled = true;
+    name_track(ShellThreads, 0, "main");
+    return true;
+}
+
+void complete(const char* name, const std::string& detail, uint64_t ts_ns, uint64_t dur_ns, Group group, int track){
+    if(!enabled()) return;
+    append(name, detail, ts_ns, dur_ns, group, track);
+}
+
+void name_track(Group group, int track, const std::string& name){
+    if(!enabled()) return;
+    append(nullptr, name, 0, 0, group, track);
+}
+
+static void json_escape(FILE* f, const char* s){
+    for(; *s; ++s){
+        unsigned char c = *s;
+        if(c == '"' || c == '\\') fprintf(f, "\\%c", c);
+        else if(c < 0x20) fprintf(f, "\\u%04x", c);
+        else fputc(c, f);
+    }
+}
+
+void finish(){
+    if(!g_enabled.exchange(false)) return;
+    std::lock_guard<std::mutex> lk(g_mtx);
+    FILE* f = fopen(g_path.c_str(), "w");
+    if(!f) return;
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(f, "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"myshell\"}},\n", ShellThreads);
+    fprintf(f, "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"jobs\"}}", JobProcesses);
+    for(Buffer* b: g_buffers){
+        for(Chunk* c = b->head; c; c = c->next.load(std::memory_order_acquire)){
+            size_t n = c->n.load(std::memory_order_acquire);
+            for(size_t i=0;i<n;++i){
+                const Event& e = c->ev[i];
+                if(!e.name){
+                    fprintf(f, ",\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"", e.group, e.track);
+                    json_escape(f, e.detail);
+                    fprintf(f, "\"}}");
+                    continue;
+                }
+                uint64_t ts = e.ts > g_epoch ? e.ts - g_epoch : 0;
+                fprintf(f, ",\n{\"ph\":\"X\",\"name\":\"%s\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+                        e.name, e.group, e.track, ts / 1e3, e.dur / 1e3);
+                if(e.detail[0]){
+                    fprintf(f, ",\"args\":{\"detail\":\"");
+                    json_escape(f, e.detail);
+                    fprintf(f, "\"}");
+                }
+                fprintf(f, "}");
+            }
+        }
+    }
+    fprintf(f, "\n]}\n");
+    fclose(f);
+}
+
+} // namespace trace
@@ -2,6 +2,8 @@
 #include <algorithm>
 #include <sstream>
 #include <cctype>
+#include <cstdlib>
+#include <cmath>
 
 std::string trim(const std::string& s){
     size_t a=0, b=s.size();
@@ -26,3 +28,14 @@ std::string join(const std::vector<std::string>& v, const std::string& sep){
     }
     return oss.str();
 }
+
+bool parse_duration(const std::string& s, uint64_t& ns){
+    char* end = nullptr;
+    double v = std::strtod(s.c_str(), &end);
+    if(s.empty() || end == s.c_str() || !std::isfinite(v) || v < 0) return false;
+    std::string unit(end);
+    double mult = unit.empty() || unit == "s" ? 1 : unit == "m" ? 60 : unit == "h" ? 3600 : unit == "d" ? 86400 : 0;
+    if(mult == 0) return false;
+    ns = (uint64_t)std::min(v * mult * 1e9, 1e18);   // ~31 years; keeps now+ns from wrapping
+    return true;
+}